@@ -0,0 +1,49 @@
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define ALIGN_BENCH_SAMPLES 200
+#define ALIGN_BENCH_OBJECTS 8
+#define ALIGN_BENCH_SIZE 100
+
+/*
+ * ALIGN_BENCH_OBJECTS sf_memalign calls of ALIGN_BENCH_SIZE bytes each (param is the
+ * alignment, 64 B to 64 KiB) on a fresh heap.  align_memalign times one call;
+ * align_heap_span is the heap the objects spanned, from the heap start to the end of the
+ * highest one, per object.  Alignments past a page come from mappings of their own and span
+ * no heap.
+ */
+BENCH(align)
+{
+    static uint64_t samples[ALIGN_BENCH_SAMPLES];
+    void *objects[ALIGN_BENCH_OBJECTS];
+
+    for (long align = 64; align <= 65536; align <<= 1)
+    {
+        uint64_t span = 0;
+
+        for (int s = 0; s < ALIGN_BENCH_SAMPLES; s++)
+        {
+            sf_mem_init();
+
+            for (int i = 0; i < ALIGN_BENCH_OBJECTS; i++)
+            {
+                uint64_t start = bench_now_ns();
+                objects[i] = sf_memalign(ALIGN_BENCH_SIZE, align);
+                if (i == ALIGN_BENCH_OBJECTS / 2)
+                    samples[s] = bench_now_ns() - start;
+
+                char *end = (char *)objects[i] + ALIGN_BENCH_SIZE;
+                if (end > (char *)sf_mem_start() && end <= (char *)sf_mem_end() && (uint64_t)(end - (char *)sf_mem_start()) > span)
+                    span = end - (char *)sf_mem_start();
+            }
+
+            for (int i = 0; i < ALIGN_BENCH_OBJECTS; i++)
+                sf_free(objects[i]);
+            sf_mem_fini();
+        }
+
+        bench_report("align_memalign", align, samples, ALIGN_BENCH_SAMPLES);
+        bench_report_value("align_heap_span", align, span / ALIGN_BENCH_OBJECTS);
+    }
+}
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define BATCH_BENCH_SAMPLES 200
+#define BATCH_BENCH_MAX 256
+#define BATCH_BENCH_NODE 100 // Same-sized list nodes, two rows each
+
+/*
+ * n nodes allocated then freed together (param is n), with sf_malloc_batch/sf_free_batch
+ * against n sf_malloc/sf_free calls.  Nodes are freed once in allocation order
+ * (batch_free_ordered_*) and once shuffled, as a list torn down after reordering would be
+ * (batch_free_*).  Each sample times the whole batch on a warm heap.
+ */
+BENCH(batch)
+{
+    static uint64_t malloc_samples[2][BATCH_BENCH_SAMPLES];
+    static uint64_t free_samples[2][BATCH_BENCH_SAMPLES];
+    static uint64_t ordered_samples[2][BATCH_BENCH_SAMPLES];
+    static void *nodes[BATCH_BENCH_MAX];
+    long counts[] = {16, 64, 256};
+
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        long n = counts[c];
+
+        sf_mem_init();
+        bench_srand(320);
+
+        for (int s = 0; s < BATCH_BENCH_SAMPLES; s++)
+        {
+            for (int batched = 0; batched <= 1; batched++)
+            {
+                uint64_t start = bench_now_ns();
+                if (batched)
+                    sf_malloc_batch(BATCH_BENCH_NODE, n, nodes);
+                else
+                    for (int i = 0; i < n; i++)
+                        nodes[i] = sf_malloc(BATCH_BENCH_NODE);
+                malloc_samples[batched][s] = bench_now_ns() - start;
+
+                start = bench_now_ns();
+                if (batched)
+                    sf_free_batch(nodes, n);
+                else
+                    for (int i = 0; i < n; i++)
+                        sf_free(nodes[i]);
+                ordered_samples[batched][s] = bench_now_ns() - start;
+
+                if (batched)
+                    sf_malloc_batch(BATCH_BENCH_NODE, n, nodes);
+                else
+                    for (int i = 0; i < n; i++)
+                        nodes[i] = sf_malloc(BATCH_BENCH_NODE);
+
+                for (int i = n - 1; i > 0; i--)
+                {
+                    int j = bench_rand() % (i + 1);
+                    void *tmp = nodes[i];
+                    nodes[i] = nodes[j];
+                    nodes[j] = tmp;
+                }
+
+                start = bench_now_ns();
+                if (batched)
+                    sf_free_batch(nodes, n);
+                else
+                    for (int i = 0; i < n; i++)
+                        sf_free(nodes[i]);
+                free_samples[batched][s] = bench_now_ns() - start;
+            }
+        }
+
+        sf_mem_fini();
+        bench_report("batch_malloc_single", n, malloc_samples[0], BATCH_BENCH_SAMPLES);
+        bench_report("batch_malloc_batch", n, malloc_samples[1], BATCH_BENCH_SAMPLES);
+        bench_report("batch_free_single", n, free_samples[0], BATCH_BENCH_SAMPLES);
+        bench_report("batch_free_batch", n, free_samples[1], BATCH_BENCH_SAMPLES);
+        bench_report("batch_free_ordered_single", n, ordered_samples[0], BATCH_BENCH_SAMPLES);
+        bench_report("batch_free_ordered_batch", n, ordered_samples[1], BATCH_BENCH_SAMPLES);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal benchmark harness for the sf allocator.
+ *
+ * Each benchmark is declared with BENCH(name) and registers itself before main runs, in the
+ * same spirit as Criterion's Test() macro.  A benchmark times individual operations with
+ * bench_now_ns() and hands the samples to bench_report(), which prints one CSV row per case.
+ */
+
+typedef struct bench_case {
+    const char *name;
+    void (*run)(void);
+    struct bench_case *next;
+} bench_case;
+
+#define BENCH(bname)                                                            \
+    static void bench_##bname(void);                                            \
+    static bench_case bench_case_##bname = {#bname, bench_##bname, NULL};      \
+    __attribute__((constructor)) static void bench_register_##bname(void)       \
+    {                                                                           \
+        bench_register(&bench_case_##bname);                                    \
+    }                                                                           \
+    static void bench_##bname(void)
+
+void bench_register(bench_case *bc);
+
+/* Monotonic clock in nanoseconds. */
+uint64_t bench_now_ns(void);
+
+/*
+ * Print one CSV row "case,param,samples,min_ns,median_ns,p99_ns" for the given samples.
+ * The samples array is sorted in place.
+ */
+void bench_report(const char *name, long param, uint64_t *samples, int n);
+
+/*
+ * Print one row in the same CSV layout for a single measured quantity, such as heap bytes,
+ * rather than a latency: samples is 1 and the three _ns columns all carry value.
+ */
+void bench_report_value(const char *name, long param, uint64_t value);
+
+/* Bytes of the sfutil heap that are resident, page by page through mincore. */
+uint64_t bench_heap_resident_bytes(void);
+
+/* Resident set size of the whole process, from /proc/self/statm. */
+uint64_t bench_process_rss_bytes(void);
+
+/* Small deterministic PRNG so every run replays the same operation sequence. */
+uint32_t bench_rand(void);
+void bench_srand(uint32_t seed);
+
+#endif
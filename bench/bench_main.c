@@ -0,0 +1,124 @@
+#define _DEFAULT_SOURCE // mincore, alongside the POSIX clock
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "sfmm.h"
+
+static bench_case *bench_cases;
+static uint32_t bench_seed = 320;
+
+void bench_register(bench_case *bc)
+{
+    // Constructors run in reverse link order; append so cases run in file order.
+    bench_case **tail = &bench_cases;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = bc;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_report(const char *name, long param, uint64_t *samples, int n)
+{
+    if (n <= 0)
+        return;
+
+    qsort(samples, n, sizeof(uint64_t), compare_samples);
+    printf("%s,%ld,%d,%lu,%lu,%lu\n", name, param, n,
+           (unsigned long)samples[0],
+           (unsigned long)samples[n / 2],
+           (unsigned long)samples[(n * 99) / 100]);
+    fflush(stdout);
+}
+
+void bench_report_value(const char *name, long param, uint64_t value)
+{
+    bench_report(name, param, &value, 1);
+}
+
+uint64_t bench_heap_resident_bytes(void)
+{
+    uintptr_t start = (uintptr_t)sf_mem_start() & ~(uintptr_t)(PAGE_SZ - 1);
+    size_t pages = ((uintptr_t)sf_mem_end() - start + PAGE_SZ - 1) / PAGE_SZ;
+    unsigned char vec[pages];
+    uint64_t resident = 0;
+
+    if (mincore((void *)start, pages * PAGE_SZ, vec) != 0)
+        return 0;
+
+    for (size_t i = 0; i < pages; i++)
+        resident += (vec[i] & 1) * PAGE_SZ;
+
+    return resident;
+}
+
+uint64_t bench_process_rss_bytes(void)
+{
+    unsigned long size, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL)
+        return 0;
+
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+uint32_t bench_rand(void)
+{
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return bench_seed >> 8;
+}
+
+void bench_srand(uint32_t seed)
+{
+    bench_seed = seed;
+}
+
+int main(int argc, char const *argv[])
+{
+    int verbose = 0;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+            verbose = 1;
+        else
+            filter = argv[i];
+    }
+
+    // sfutil logs every sf_mem_init/sf_mem_grow on stderr, which would swamp the results.
+    if (!verbose)
+        freopen("/dev/null", "w", stderr);
+
+    printf("case,param,samples,min_ns,median_ns,p99_ns\n");
+    for (bench_case *bc = bench_cases; bc != NULL; bc = bc->next)
+    {
+        if (filter != NULL && strstr(bc->name, filter) == NULL)
+            continue;
+        bc->run();
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define CALLOC_BENCH_SAMPLES 200
+
+/*
+ * Large zeroed allocations (param is the size in bytes), each sample on a heap where a block
+ * of that size was just written and freed:
+ *   calloc_memset          sf_malloc then memset, the old way
+ *   calloc_recycled        sf_calloc on the dirty memory, which it must clear
+ *   calloc_trimmed_memset  sf_malloc then memset after sf_malloc_trim(0) released the pages
+ *   calloc_trimmed         sf_calloc on the released pages, which it leaves untouched
+ *   calloc_mapped          sf_calloc with SF_OPT_MMAP_THRESHOLD at 4 KiB, a fresh mapping
+ * Carving the block off a trimmed wilderness faults in the page its tags land on either way;
+ * the memset also faults in every page of the block.
+ */
+BENCH(calloc_large)
+{
+    static uint64_t samples[CALLOC_BENCH_SAMPLES];
+    const char *cases[] = {"calloc_memset", "calloc_recycled", "calloc_trimmed_memset", "calloc_trimmed", "calloc_mapped"};
+    long sizes[] = {8192, 16384, 32768};
+
+    for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        for (int z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++)
+        {
+            long size = sizes[z];
+
+            for (int s = 0; s < CALLOC_BENCH_SAMPLES; s++)
+            {
+                sf_mem_init();
+                void *pp = sf_malloc(size);
+                memset(pp, 1, size);
+                sf_free(pp);
+
+                if (c == 2 || c == 3)
+                    sf_malloc_trim(0);
+                if (c == 4)
+                    sf_mallopt(SF_OPT_MMAP_THRESHOLD, 4096);
+
+                uint64_t start = bench_now_ns();
+                if (c == 0 || c == 2)
+                {
+                    pp = sf_malloc(size);
+                    memset(pp, 0, size);
+                }
+                else
+                    pp = sf_calloc(1, size);
+                samples[s] = bench_now_ns() - start;
+
+                sf_free(pp);
+                sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+                sf_mem_fini();
+            }
+
+            bench_report(cases[c], size, samples, CALLOC_BENCH_SAMPLES);
+        }
+    }
+}
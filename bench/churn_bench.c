@@ -0,0 +1,53 @@
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define CHURN_BENCH_OPS 20000
+#define CHURN_BENCH_MAX_SLOTS 64
+#define CHURN_BENCH_MAX_REQUEST 1024
+
+/*
+ * Random-size churn at steady occupancy (param is the number of live blocks).  The working
+ * set is filled first; then each op frees a random slot and refills it with a block of random
+ * size, up to CHURN_BENCH_MAX_REQUEST bytes, so the heap holds about param blocks throughout.
+ * Each sample times one op, the sf_free and the sf_malloc together.  churn_failures counts
+ * the requests sfutil's 16 pages could not serve.
+ */
+BENCH(churn)
+{
+    static uint64_t samples[CHURN_BENCH_OPS];
+    void *slots[CHURN_BENCH_MAX_SLOTS];
+    long occupancy[] = {16, 32, 64};
+
+    for (int o = 0; o < sizeof(occupancy) / sizeof(occupancy[0]); o++)
+    {
+        long n = occupancy[o];
+        uint64_t failures = 0;
+
+        sf_mem_init();
+        bench_srand(320);
+
+        for (int i = 0; i < n; i++)
+            slots[i] = sf_malloc(1 + bench_rand() % CHURN_BENCH_MAX_REQUEST);
+
+        for (int op = 0; op < CHURN_BENCH_OPS; op++)
+        {
+            int slot = bench_rand() % n;
+            size_t size = 1 + bench_rand() % CHURN_BENCH_MAX_REQUEST;
+
+            uint64_t start = bench_now_ns();
+            sf_free(slots[slot]);
+            slots[slot] = sf_malloc(size);
+            samples[op] = bench_now_ns() - start;
+
+            failures += slots[slot] == NULL;
+        }
+
+        for (int i = 0; i < n; i++)
+            sf_free(slots[i]);
+        sf_mem_fini();
+
+        bench_report("churn_op", n, samples, CHURN_BENCH_OPS);
+        bench_report_value("churn_failures", n, failures);
+    }
+}
@@ -0,0 +1,47 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+
+#define COALESCE_BENCH_SAMPLES 500
+#define CLASS8_PAYLOAD (35 * 64 - 8) // Smallest request that lands in the "> 34M" class
+
+/*
+ * Cost of a free that coalesces with two class-8 neighbours, as a function of how many
+ * other blocks sit in the class-8 list.  The heap is laid out as big/small pairs, every
+ * big block is freed (oldest at the tail of the list), then the small block between the
+ * two oldest big blocks is freed so both neighbours must be unlinked from deep in the list.
+ */
+BENCH(coalesce_class8)
+{
+    static void *big[32];
+    static void *small[32];
+    static uint64_t samples[COALESCE_BENCH_SAMPLES];
+    long lengths[] = {2, 8, 16, 28};
+
+    for (int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+    {
+        long n = lengths[l];
+
+        for (int s = 0; s < COALESCE_BENCH_SAMPLES; s++)
+        {
+            sf_mem_init();
+
+            for (int i = 0; i < n; i++)
+            {
+                big[i] = sf_malloc(CLASS8_PAYLOAD);
+                small[i] = sf_malloc(1);
+            }
+            for (int i = 0; i < n; i++)
+                sf_free(big[i]);
+
+            uint64_t start = bench_now_ns();
+            sf_free(small[0]);
+            samples[s] = bench_now_ns() - start;
+
+            sf_mem_fini();
+        }
+
+        bench_report("coalesce_class8", n, samples, COALESCE_BENCH_SAMPLES);
+    }
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define FIT_BENCH_SAMPLES 50
+#define FIT_BENCH_OPS 2000
+#define FIT_BENCH_SLOTS 24
+#define FIT_BENCH_MAX_REQUEST 1500
+
+/*
+ * One mixed-size trace replayed under each SF_OPT_FIT_POLICY (param is the policy constant,
+ * SF_FIT_GOOD with the default four candidates).  Each op replaces a random slot of the
+ * working set with a block of random size, so frees and requests of unrelated sizes
+ * interleave.  fit_trace is the wall time of one replay on a fresh heap; fit_peak_heap is
+ * the highest heap offset any request reached, which tracks fragmentation more finely than
+ * whole sfutil pages, and fit_failures how many requests came back
+ * NULL because sfutil ran out of pages.
+ */
+BENCH(fit_policy)
+{
+    static uint64_t samples[FIT_BENCH_SAMPLES];
+    void *slots[FIT_BENCH_SLOTS];
+
+    for (int policy = SF_FIT_FIRST; policy <= SF_FIT_GOOD; policy++)
+    {
+        uint64_t peak = 0, failures = 0;
+
+        for (int s = 0; s < FIT_BENCH_SAMPLES; s++)
+        {
+            sf_mem_init();
+            sf_mallopt(SF_OPT_FIT_POLICY, policy);
+            bench_srand(320);
+
+            for (int i = 0; i < FIT_BENCH_SLOTS; i++)
+                slots[i] = NULL;
+
+            uint64_t start = bench_now_ns();
+            for (int op = 0; op < FIT_BENCH_OPS; op++)
+            {
+                int slot = bench_rand() % FIT_BENCH_SLOTS;
+
+                if (slots[slot] != NULL)
+                    sf_free(slots[slot]);
+
+                size_t size = 1 + bench_rand() % FIT_BENCH_MAX_REQUEST;
+                if ((slots[slot] = sf_malloc(size)) == NULL)
+                    failures++;
+                else if ((uint64_t)((char *)slots[slot] + size - (char *)sf_mem_start()) > peak)
+                    peak = (char *)slots[slot] + size - (char *)sf_mem_start();
+            }
+            samples[s] = bench_now_ns() - start;
+
+            sf_mallopt(SF_OPT_FIT_POLICY, SF_FIT_FIRST);
+            sf_mem_fini();
+        }
+
+        bench_report("fit_trace", policy, samples, FIT_BENCH_SAMPLES);
+        bench_report_value("fit_peak_heap", policy, peak);
+        bench_report_value("fit_failures", policy, failures / FIT_BENCH_SAMPLES);
+    }
+}
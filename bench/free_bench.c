@@ -0,0 +1,97 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define FREE_BENCH_SAMPLES 2000
+#define FREE_BENCH_RUN 32 // Frees timed together, to rise above the clock's own cost
+
+/*
+ * Free latency as a function of the number of live blocks in the heap.
+ * Every live block is a minimum-size block, and the freed block always has allocated
+ * neighbours, so the cost measured is validation plus neighbour discovery plus insertion.
+ */
+BENCH(free_live_blocks)
+{
+    static void *live[1000];
+    static uint64_t samples[FREE_BENCH_SAMPLES];
+    long counts[] = {10, 100, 1000};
+
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        long n = counts[c];
+
+        sf_mem_init();
+        bench_srand(320);
+
+        for (int i = 0; i < n; i++)
+            live[i] = sf_malloc(1);
+
+        for (int s = 0; s < FREE_BENCH_SAMPLES; s++)
+        {
+            // Skip the last block so the freed block never borders the wilderness.
+            int victim = bench_rand() % (n - 1);
+
+            uint64_t start = bench_now_ns();
+            sf_free(live[victim]);
+            samples[s] = bench_now_ns() - start;
+
+            live[victim] = sf_malloc(1);
+        }
+
+        sf_mem_fini();
+        bench_report("free_live_blocks", n, samples, FREE_BENCH_SAMPLES);
+    }
+}
+
+/*
+ * sf_free against sf_free_sized for 100- and 1000-byte requests (param), first straight to
+ * the heap and then through a thread cache.  Each sample is the mean of FREE_BENCH_RUN frees
+ * of blocks separated by live ones, so every free takes the same path.
+ */
+BENCH(free_sized)
+{
+    static void *blocks[FREE_BENCH_RUN];
+    static void *pins[FREE_BENCH_RUN];
+    static uint64_t samples[FREE_BENCH_SAMPLES / 10];
+    const char *cases[] = {"free_plain", "free_sized", "free_plain_tcache", "free_sized_tcache"};
+    long sizes[] = {100, 1000};
+
+    for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        for (int z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++)
+        {
+            long size = sizes[z];
+
+            sf_mem_init();
+            sf_mallopt(SF_OPT_TCACHE_COUNT, c >= 2 ? SF_TCACHE_MAX_COUNT : 0);
+
+            for (int s = 0; s < FREE_BENCH_SAMPLES / 10; s++)
+            {
+                for (int i = 0; i < FREE_BENCH_RUN; i++)
+                {
+                    blocks[i] = sf_malloc(size);
+                    pins[i] = sf_malloc(1);
+                }
+
+                uint64_t start = bench_now_ns();
+                for (int i = 0; i < FREE_BENCH_RUN; i++)
+                {
+                    if (c % 2)
+                        sf_free_sized(blocks[i], size);
+                    else
+                        sf_free(blocks[i]);
+                }
+                samples[s] = (bench_now_ns() - start) / FREE_BENCH_RUN;
+
+                for (int i = 0; i < FREE_BENCH_RUN; i++)
+                    sf_free(pins[i]);
+            }
+
+            sf_mallopt(SF_OPT_TCACHE_COUNT, 0);
+            sf_mem_fini();
+            bench_report(cases[c], size, samples, FREE_BENCH_SAMPLES / 10);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define GROWTH_BENCH_SAMPLES 500
+#define GROWTH_BENCH_MEDIUM 14
+#define GROWTH_BENCH_RUNS 200
+#define GROWTH_BENCH_MAX_BLOCKS 1024
+
+/*
+ * Cold-start allocation: every sample starts from a fresh, empty sfutil heap.
+ * cold_large times one sf_malloc of param bytes, which has to grow the heap by that much at once.
+ * cold_medium_exact and cold_medium_geometric time GROWTH_BENCH_MEDIUM sf_mallocs of param bytes
+ * under each SF_OPT_GROWTH_POLICY.
+ */
+BENCH(cold_start)
+{
+    static uint64_t samples[GROWTH_BENCH_SAMPLES];
+    long large_sizes[] = {16384, 32768, 61440};
+
+    for (int i = 0; i < sizeof(large_sizes) / sizeof(large_sizes[0]); i++)
+    {
+        for (int s = 0; s < GROWTH_BENCH_SAMPLES; s++)
+        {
+            sf_mem_init();
+            uint64_t start = bench_now_ns();
+            sf_malloc(large_sizes[i]);
+            samples[s] = bench_now_ns() - start;
+            sf_mem_fini();
+        }
+        bench_report("cold_large", large_sizes[i], samples, GROWTH_BENCH_SAMPLES);
+    }
+
+    for (int policy = SF_GROWTH_EXACT; policy <= SF_GROWTH_GEOMETRIC; policy++)
+    {
+        sf_mallopt(SF_OPT_GROWTH_POLICY, policy);
+
+        for (int s = 0; s < GROWTH_BENCH_SAMPLES; s++)
+        {
+            sf_mem_init();
+            uint64_t start = bench_now_ns();
+            for (int i = 0; i < GROWTH_BENCH_MEDIUM; i++)
+                sf_malloc(4000);
+            samples[s] = bench_now_ns() - start;
+            sf_mem_fini();
+        }
+        bench_report(policy == SF_GROWTH_EXACT ? "cold_medium_exact" : "cold_medium_geometric", 4000,
+                     samples, GROWTH_BENCH_SAMPLES);
+    }
+
+    sf_mallopt(SF_OPT_GROWTH_POLICY, SF_GROWTH_EXACT);
+}
+
+/*
+ * Sustained growth: sf_malloc of param bytes, never freed, from a fresh heap until sfutil
+ * runs out of pages.  Each sample times one call over GROWTH_BENCH_RUNS fills, so the
+ * median is a carve from the wilderness and the tail the calls that had to grow the heap
+ * first.  The request that finally fails is not counted.
+ */
+BENCH(sustained_growth)
+{
+    static uint64_t samples[GROWTH_BENCH_RUNS * GROWTH_BENCH_MAX_BLOCKS];
+    long sizes[] = {100, 1000, 4000};
+
+    for (int z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++)
+    {
+        int n = 0;
+
+        for (int r = 0; r < GROWTH_BENCH_RUNS; r++)
+        {
+            sf_mem_init();
+
+            for (int i = 0; i < GROWTH_BENCH_MAX_BLOCKS; i++)
+            {
+                uint64_t start = bench_now_ns();
+                void *pp = sf_malloc(sizes[z]);
+                uint64_t elapsed = bench_now_ns() - start;
+
+                if (pp == NULL)
+                    break;
+                samples[n++] = elapsed;
+            }
+
+            sf_mem_fini();
+        }
+
+        bench_report("sustained_growth", sizes[z], samples, n);
+    }
+}
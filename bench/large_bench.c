@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define LARGE_BENCH_SAMPLES 1000
+
+/*
+ * Large blocks from the heap (large_heap_*) against mappings of their own (large_mmap_*,
+ * SF_OPT_MMAP_THRESHOLD at 8 KiB).  large_*_pair times an sf_malloc/sf_free pair of param
+ * bytes; large_*_realloc times growing a written param-byte block to twice its size.
+ */
+BENCH(large_objects)
+{
+    static uint64_t samples[LARGE_BENCH_SAMPLES];
+    long sizes[] = {8192, 12288, 16384}; // Twice the largest still fits in the 16-page sfutil heap
+
+    for (int use_mmap = 0; use_mmap <= 1; use_mmap++)
+    {
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            sf_mem_init();
+            sf_mallopt(SF_OPT_MMAP_THRESHOLD, use_mmap ? 8192 : 0);
+            void *keep = sf_malloc(1); // Keeps the large block off the prologue
+
+            for (int s = 0; s < LARGE_BENCH_SAMPLES; s++)
+            {
+                uint64_t start = bench_now_ns();
+                sf_free(sf_malloc(sizes[i]));
+                samples[s] = bench_now_ns() - start;
+            }
+            bench_report(use_mmap ? "large_mmap_pair" : "large_heap_pair", sizes[i], samples, LARGE_BENCH_SAMPLES);
+
+            for (int s = 0; s < LARGE_BENCH_SAMPLES; s++)
+            {
+                char *block = sf_malloc(sizes[i]);
+                memset(block, 1, sizes[i]);
+
+                uint64_t start = bench_now_ns();
+                block = sf_realloc(block, 2 * sizes[i]);
+                samples[s] = bench_now_ns() - start;
+
+                sf_free(block);
+            }
+            bench_report(use_mmap ? "large_mmap_realloc" : "large_heap_realloc", sizes[i], samples, LARGE_BENCH_SAMPLES);
+
+            sf_free(keep);
+            sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+            sf_mem_fini();
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define LATENCY_BENCH_OPS 20000
+#define LATENCY_BENCH_SLOTS 24
+#define LATENCY_BENCH_MAX_REQUEST 1500
+
+static const char *latency_bench_names[SF_OP_COUNT] = {"latency_malloc", "latency_free", "latency_realloc", "latency_memalign",
+                                                       "latency_free_sized", "latency_realloc_in_place", "latency_calloc",
+                                                       "latency_malloc_batch", "latency_free_batch"};
+
+/*
+ * The allocator's own latency histograms over a mixed trace of sf_malloc, sf_free,
+ * sf_realloc and sf_memalign calls of random sizes, one row per operation and size class
+ * (param is the class): samples is the number of calls, and min_ns, median_ns and p99_ns are
+ * the histogram's p0, p50 and p99, each the upper bound of its bucket.  Only a build with
+ * -DSF_LATENCY (make latency) records anything; other builds print no rows.
+ */
+BENCH(latency)
+{
+    static struct sf_latency latency;
+    void *slots[LATENCY_BENCH_SLOTS] = {NULL};
+
+    sf_mem_init();
+    sf_latency_reset();
+    bench_srand(320);
+
+    for (int op = 0; op < LATENCY_BENCH_OPS; op++)
+    {
+        int slot = bench_rand() % LATENCY_BENCH_SLOTS;
+        size_t size = 1 + bench_rand() % LATENCY_BENCH_MAX_REQUEST;
+
+        if (slots[slot] != NULL && bench_rand() % 2 == 0)
+            slots[slot] = sf_realloc(slots[slot], size);
+        else
+        {
+            if (slots[slot] != NULL)
+                sf_free(slots[slot]);
+
+            if (bench_rand() % 8 == 0)
+                slots[slot] = sf_memalign(size, 64 << (bench_rand() % 4));
+            else
+                slots[slot] = sf_malloc(size);
+        }
+    }
+
+    for (int i = 0; i < LATENCY_BENCH_SLOTS; i++)
+        if (slots[i] != NULL)
+            sf_free(slots[i]);
+    sf_mem_fini();
+
+    memset(&latency, 0, sizeof(latency));
+    sf_latency_merge(&latency);
+
+    for (int op = 0; op < SF_OP_COUNT; op++)
+    {
+        for (int c = 0; c < SF_STATS_CLASSES; c++)
+        {
+            const struct sf_latency_histogram *histogram = &latency.ops[op][c];
+            size_t count = 0;
+
+            for (int i = 0; i < SF_LATENCY_BUCKETS; i++)
+                count += histogram->counts[i];
+
+            if (count != 0)
+                printf("%s,%d,%zu,%.0f,%.0f,%.0f\n", latency_bench_names[op], c, count,
+                       sf_latency_percentile(histogram, 0), sf_latency_percentile(histogram, 0.5),
+                       sf_latency_percentile(histogram, 0.99));
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define MT_BENCH_SAMPLES 50
+#define MT_BENCH_OPS 10000
+#define MT_BENCH_SLOTS 8
+#define MT_BENCH_MAX_THREADS 8
+
+/*
+ * Each thread replaces random blocks in its own small working set with blocks of random
+ * size, MT_BENCH_OPS times.  Slots stay small enough for eight threads to share the 16
+ * pages sfutil hands out.
+ */
+static void *mt_worker(void *arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    void *slots[MT_BENCH_SLOTS] = {NULL};
+
+    for (int i = 0; i < MT_BENCH_OPS; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int slot = (seed >> 16) % MT_BENCH_SLOTS;
+
+        if (slots[slot] != NULL)
+            sf_free(slots[slot]);
+        slots[slot] = sf_malloc(1 + (seed >> 8) % 256);
+    }
+
+    for (int i = 0; i < MT_BENCH_SLOTS; i++)
+        if (slots[i] != NULL)
+            sf_free(slots[i]);
+
+    return NULL;
+}
+
+/*
+ * Throughput of the single locked heap with 1, 2, 4 and 8 threads (param).  Each sample is the
+ * wall time for every thread to finish its MT_BENCH_OPS malloc/free pairs.
+ */
+BENCH(mt_throughput)
+{
+    static uint64_t samples[MT_BENCH_SAMPLES];
+    pthread_t threads[MT_BENCH_MAX_THREADS];
+
+    for (int n = 1; n <= MT_BENCH_MAX_THREADS; n *= 2)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_MULTITHREADED, 1);
+
+        for (int s = 0; s < MT_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            for (long t = 0; t < n; t++)
+                pthread_create(&threads[t], NULL, mt_worker, (void *)(t + 1));
+            for (int t = 0; t < n; t++)
+                pthread_join(threads[t], NULL);
+            samples[s] = bench_now_ns() - start;
+        }
+
+        sf_mallopt(SF_OPT_MULTITHREADED, 0);
+        sf_mem_fini();
+        bench_report("mt_throughput", n, samples, MT_BENCH_SAMPLES);
+    }
+}
+
+/*
+ * Same workload with one arena per thread (param is both the thread and the arena count).
+ * Threads only meet on an arena lock when they free each other's blocks, which this workload
+ * never does, so wall time should stay flat up to the number of cores.
+ */
+BENCH(arena_scaling)
+{
+    static uint64_t samples[MT_BENCH_SAMPLES];
+    pthread_t threads[MT_BENCH_MAX_THREADS];
+
+    for (int n = 1; n <= MT_BENCH_MAX_THREADS; n *= 2)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_MULTITHREADED, 1);
+        sf_mallopt(SF_OPT_ARENA_COUNT, n);
+
+        for (int s = 0; s < MT_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            for (long t = 0; t < n; t++)
+                pthread_create(&threads[t], NULL, mt_worker, (void *)(t + 1));
+            for (int t = 0; t < n; t++)
+                pthread_join(threads[t], NULL);
+            samples[s] = bench_now_ns() - start;
+        }
+
+        sf_mallopt(SF_OPT_ARENA_COUNT, 1);
+        sf_mallopt(SF_OPT_MULTITHREADED, 0);
+        sf_mem_fini();
+        bench_report("arena_scaling", n, samples, MT_BENCH_SAMPLES);
+    }
+}
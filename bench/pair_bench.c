@@ -0,0 +1,42 @@
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define PAIR_BENCH_SAMPLES 2000
+#define PAIR_BENCH_RUN 100 // Pairs averaged into each sample
+
+/*
+ * sf_malloc/sf_free pairs in each size class (param is the class).  The request fills a block
+ * of the class's smallest size, 1, 2, 3, 5, 8, 13, 21, 34 and 55 units of 64 bytes less the
+ * header, so the free list it is served from is the class's own.  A live block on each side
+ * keeps the freed block from coalescing into the wilderness.  Each sample is the mean of
+ * PAIR_BENCH_RUN pairs on a warm heap.
+ */
+BENCH(malloc_free_pair)
+{
+    static uint64_t samples[PAIR_BENCH_SAMPLES];
+    long units[] = {1, 2, 3, 5, 8, 13, 21, 34, 55};
+
+    for (int c = 0; c < sizeof(units) / sizeof(units[0]); c++)
+    {
+        size_t size = units[c] * 64 - sizeof(sf_header);
+
+        sf_mem_init();
+        void *before = sf_malloc(1);
+        sf_free(sf_malloc(size));
+        void *after = sf_malloc(1);
+
+        for (int s = 0; s < PAIR_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            for (int i = 0; i < PAIR_BENCH_RUN; i++)
+                sf_free(sf_malloc(size));
+            samples[s] = (bench_now_ns() - start) / PAIR_BENCH_RUN;
+        }
+
+        sf_free(after);
+        sf_free(before);
+        sf_mem_fini();
+        bench_report("malloc_free_pair", c, samples, PAIR_BENCH_SAMPLES);
+    }
+}
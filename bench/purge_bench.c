@@ -0,0 +1,70 @@
+#define _POSIX_C_SOURCE 200809L // nanosleep
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define PURGE_BENCH_BLOCKS 4
+#define PURGE_BENCH_BLOCK_SZ 12000
+#define PURGE_BENCH_DECAY_MS 10
+#define PURGE_BENCH_SMALL 64 // Enough frees to run at least one decay scan
+#define PURGE_BENCH_SAMPLES 200
+
+static const int purge_bench_modes[] = {-1, 0, PURGE_BENCH_DECAY_MS};
+
+/*
+ * Fragmented idle heap: PURGE_BENCH_BLOCKS written blocks of PURGE_BENCH_BLOCK_SZ bytes, each
+ * pinned in the middle of the heap by a small live block, are freed.  purge_heap_resident
+ * reports the resident heap afterwards for each SF_OPT_PURGE_DECAY setting (param 0 never,
+ * 1 on free, 2 after PURGE_BENCH_DECAY_MS once enough further frees have run a scan);
+ * purge_free times freeing one such block under the same settings.
+ */
+BENCH(purge_idle)
+{
+    static uint64_t samples[PURGE_BENCH_SAMPLES];
+    void *blocks[PURGE_BENCH_BLOCKS], *pins[PURGE_BENCH_BLOCKS], *small[PURGE_BENCH_SMALL];
+    struct timespec decay = {0, (PURGE_BENCH_DECAY_MS + 1) * 1000000L};
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_PURGE_DECAY, purge_bench_modes[mode]);
+
+        for (int i = 0; i < PURGE_BENCH_BLOCKS; i++)
+        {
+            blocks[i] = sf_malloc(PURGE_BENCH_BLOCK_SZ);
+            pins[i] = sf_malloc(1);
+            memset(blocks[i], 1, PURGE_BENCH_BLOCK_SZ);
+        }
+        for (int i = 0; i < PURGE_BENCH_SMALL; i++)
+            small[i] = sf_malloc(1);
+
+        for (int i = 0; i < PURGE_BENCH_BLOCKS; i++)
+            sf_free(blocks[i]);
+
+        nanosleep(&decay, NULL);
+        for (int i = 0; i < PURGE_BENCH_SMALL; i++)
+            sf_free(small[i]);
+
+        bench_report_value("purge_heap_resident", mode, bench_heap_resident_bytes());
+
+        for (int s = 0; s < PURGE_BENCH_SAMPLES; s++)
+        {
+            void *pp = sf_malloc(PURGE_BENCH_BLOCK_SZ);
+            memset(pp, 1, PURGE_BENCH_BLOCK_SZ);
+
+            uint64_t start = bench_now_ns();
+            sf_free(pp);
+            samples[s] = bench_now_ns() - start;
+        }
+
+        bench_report("purge_free", mode, samples, PURGE_BENCH_SAMPLES);
+
+        for (int i = 0; i < PURGE_BENCH_BLOCKS; i++)
+            sf_free(pins[i]);
+        sf_mallopt(SF_OPT_PURGE_DECAY, -1);
+        sf_mem_fini();
+    }
+}
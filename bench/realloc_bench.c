@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define REALLOC_BENCH_SAMPLES 2000
+#define REALLOC_BENCH_MAX (16 * 1024)
+
+/*
+ * A buffer that starts at 64 bytes and doubles up to REALLOC_BENCH_MAX through sf_realloc,
+ * as a growing vector or string builder would.  Param 0 moves a block that borders the
+ * wilderness, param 1 (SF_OPT_REALLOC_WILDERNESS) grows it in place.  Each sample times one
+ * whole doubling sequence plus the final sf_free.
+ */
+BENCH(realloc_doubling)
+{
+    static uint64_t samples[REALLOC_BENCH_SAMPLES];
+
+    for (int in_place = 0; in_place <= 1; in_place++)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_REALLOC_WILDERNESS, in_place);
+        void *keep = sf_malloc(1); // Keeps the buffer off the prologue
+
+        for (int s = 0; s < REALLOC_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            char *buffer = sf_malloc(64);
+            for (size_t size = 128; size <= REALLOC_BENCH_MAX; size *= 2)
+                buffer = sf_realloc(buffer, size);
+            sf_free(buffer);
+            samples[s] = bench_now_ns() - start;
+        }
+
+        sf_free(keep);
+        sf_mallopt(SF_OPT_REALLOC_WILDERNESS, 0);
+        sf_mem_fini();
+        bench_report("realloc_doubling", in_place, samples, REALLOC_BENCH_SAMPLES);
+    }
+}
+
+/*
+ * The same buffer shrunk back: it starts at REALLOC_BENCH_MAX and halves down to 64 bytes
+ * through sf_realloc, each shrink splitting the tail off in place (param is unused, 0).  A
+ * live block after the buffer keeps the tails from merging into the wilderness.  Each sample
+ * times one whole halving sequence plus the final sf_free.
+ */
+BENCH(realloc_halving)
+{
+    static uint64_t samples[REALLOC_BENCH_SAMPLES];
+
+    sf_mem_init();
+    void *keep = sf_malloc(1);
+
+    for (int s = 0; s < REALLOC_BENCH_SAMPLES; s++)
+    {
+        char *buffer = sf_malloc(REALLOC_BENCH_MAX);
+        void *fence = sf_malloc(1);
+
+        uint64_t start = bench_now_ns();
+        for (size_t size = REALLOC_BENCH_MAX / 2; size >= 64; size /= 2)
+            buffer = sf_realloc(buffer, size);
+        sf_free(buffer);
+        samples[s] = bench_now_ns() - start;
+
+        sf_free(fence);
+    }
+
+    sf_free(keep);
+    sf_mem_fini();
+    bench_report("realloc_halving", 0, samples, REALLOC_BENCH_SAMPLES);
+}
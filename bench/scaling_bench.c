@@ -0,0 +1,298 @@
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define SCALING_BENCH_SAMPLES 50
+#define SCALING_BENCH_MAX_THREADS 8
+
+#define THREADTEST_ROUNDS 200
+#define THREADTEST_BATCH 16
+#define THREADTEST_SIZE 64
+
+#define XMALLOC_OPS 4000
+#define XMALLOC_QUEUE 32
+#define XMALLOC_SIZE 100
+
+#define LARSON_OPS 4000
+#define LARSON_SLOTS 128
+#define LARSON_MAX_REQUEST 256
+
+/*
+ * Multi-threaded workloads after the classic allocator benchmarks, each run with sf (one
+ * arena per thread, SF_OPT_MULTITHREADED on) and with the system malloc:
+ *   threadtest  every thread allocates a batch of blocks and frees it again, sharing nothing
+ *   xmalloc     producer threads allocate blocks and hand them through a queue to a consumer
+ *               thread of their own, which frees them
+ *   larson      every thread replaces random blocks in one array all threads share, freeing
+ *               whatever block it displaced, which another thread most likely allocated
+ * Param is the number of threads, for xmalloc the number of producer/consumer pairs.  Each
+ * sample is the wall time for every thread to finish its fixed share of operations, so
+ * perfect scaling keeps it flat.  <case>_<allocator>_heap_bytes is the heap the allocator
+ * grew to, and <case>_<allocator>_blowup_pct that heap as a percentage of the most the
+ * workload held live.
+ *
+ * Every allocator and thread count runs in a child process of its own, so neither the
+ * system malloc's arenas nor its cached memory carry over from one row to the next.
+ */
+typedef struct scaling_allocator {
+    const char *name;
+    void (*init)(int threads);
+    void *(*malloc)(size_t size);
+    void (*free)(void *pp);
+    size_t (*heap_bytes)(void);
+} scaling_allocator;
+
+typedef struct scaling_workload {
+    const char *name;
+    int threads_per_param;
+    void *(*worker)(void *arg); // arg is the thread's index
+    void (*start)(void);        // Before each run, untimed
+    size_t (*finish)(int threads); // After each run, untimed: frees what is left, returns the peak live bytes
+} scaling_workload;
+
+static const scaling_allocator *scaling_alloc; // The allocator the workers call
+
+static void sf_scaling_init(int threads)
+{
+    sf_mem_init();
+    sf_mallopt(SF_OPT_MULTITHREADED, 1);
+    sf_mallopt(SF_OPT_ARENA_COUNT, threads < SF_MAX_ARENAS ? threads : SF_MAX_ARENAS);
+}
+
+static size_t sf_scaling_heap_bytes(void)
+{
+    struct sf_stats stats;
+    sf_get_stats(&stats);
+    return stats.peak_heap_bytes + stats.large_bytes;
+}
+
+static void system_scaling_init(int threads)
+{
+}
+
+/* Every arena's memory, which glibc keeps once it has grown, plus mappings */
+static size_t system_scaling_heap_bytes(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+}
+
+static const scaling_allocator scaling_allocators[] = {
+    {"sf", sf_scaling_init, sf_malloc, sf_free, sf_scaling_heap_bytes},
+    {"system", system_scaling_init, malloc, free, system_scaling_heap_bytes},
+};
+
+static void scaling_run(const scaling_workload *workload, const scaling_allocator *alloc, int param)
+{
+    static uint64_t samples[SCALING_BENCH_SAMPLES];
+    pthread_t threads[SCALING_BENCH_MAX_THREADS];
+    int n = param * workload->threads_per_param;
+    size_t live = 0;
+    char name[64];
+
+    scaling_alloc = alloc;
+    alloc->init(n);
+    size_t base = alloc->heap_bytes();
+
+    for (int s = 0; s < SCALING_BENCH_SAMPLES; s++)
+    {
+        workload->start();
+
+        uint64_t start = bench_now_ns();
+        for (long t = 0; t < n; t++)
+            pthread_create(&threads[t], NULL, workload->worker, (void *)t);
+        for (int t = 0; t < n; t++)
+            pthread_join(threads[t], NULL);
+        samples[s] = bench_now_ns() - start;
+
+        size_t peak = workload->finish(n);
+        if (peak > live)
+            live = peak;
+    }
+
+    size_t heap = alloc->heap_bytes() - base;
+
+    snprintf(name, sizeof(name), "%s_%s", workload->name, alloc->name);
+    bench_report(name, param, samples, SCALING_BENCH_SAMPLES);
+    snprintf(name, sizeof(name), "%s_%s_heap_bytes", workload->name, alloc->name);
+    bench_report_value(name, param, heap);
+    snprintf(name, sizeof(name), "%s_%s_blowup_pct", workload->name, alloc->name);
+    bench_report_value(name, param, live == 0 ? 0 : heap * 100 / live);
+}
+
+static void scaling_bench(const scaling_workload *workload)
+{
+    for (int a = 0; a < sizeof(scaling_allocators) / sizeof(scaling_allocators[0]); a++)
+    {
+        for (int param = 1; param * workload->threads_per_param <= SCALING_BENCH_MAX_THREADS; param *= 2)
+        {
+            fflush(stdout); // Or the child prints whatever is still buffered a second time
+            pid_t child = fork();
+
+            if (child == 0)
+            {
+                scaling_run(workload, &scaling_allocators[a], param);
+                _exit(0);
+            }
+            if (child > 0)
+                waitpid(child, NULL, 0);
+        }
+    }
+}
+
+static void *threadtest_worker(void *arg)
+{
+    void *blocks[THREADTEST_BATCH];
+
+    for (int r = 0; r < THREADTEST_ROUNDS; r++)
+    {
+        for (int i = 0; i < THREADTEST_BATCH; i++)
+            blocks[i] = scaling_alloc->malloc(THREADTEST_SIZE);
+        for (int i = 0; i < THREADTEST_BATCH; i++)
+            scaling_alloc->free(blocks[i]);
+    }
+
+    return NULL;
+}
+
+static void threadtest_start(void)
+{
+}
+
+static size_t threadtest_finish(int threads)
+{
+    return (size_t)threads * THREADTEST_BATCH * THREADTEST_SIZE;
+}
+
+/*
+ * One queue per producer/consumer pair, its indices on cache lines of their own.  peak is the
+ * deepest the producer saw the queue, consumer's block in hand included.
+ */
+typedef struct xmalloc_queue {
+    void *slots[XMALLOC_QUEUE];
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+    size_t peak;
+} xmalloc_queue;
+
+static xmalloc_queue xmalloc_queues[SCALING_BENCH_MAX_THREADS / 2];
+
+static void *xmalloc_worker(void *arg)
+{
+    long t = (long)arg;
+    xmalloc_queue *queue = &xmalloc_queues[t / 2];
+
+    for (size_t i = 0; i < XMALLOC_OPS; i++)
+    {
+        if (t % 2 == 0)
+        {
+            size_t depth;
+
+            while ((depth = i - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) == XMALLOC_QUEUE)
+                sched_yield();
+
+            if (depth + 1 > queue->peak)
+                queue->peak = depth + 1;
+
+            queue->slots[i % XMALLOC_QUEUE] = scaling_alloc->malloc(XMALLOC_SIZE);
+            __atomic_store_n(&queue->head, i + 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            while (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == i)
+                sched_yield();
+
+            scaling_alloc->free(queue->slots[i % XMALLOC_QUEUE]);
+            __atomic_store_n(&queue->tail, i + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+static void xmalloc_start(void)
+{
+    for (int q = 0; q < SCALING_BENCH_MAX_THREADS / 2; q++)
+        xmalloc_queues[q].head = xmalloc_queues[q].tail = xmalloc_queues[q].peak = 0;
+}
+
+static size_t xmalloc_finish(int threads)
+{
+    size_t live = 0;
+
+    for (int q = 0; q < SCALING_BENCH_MAX_THREADS / 2; q++)
+        live += xmalloc_queues[q].peak * XMALLOC_SIZE;
+
+    return live;
+}
+
+/* Each block carries its size in its first word, so the slots' live bytes can be summed. */
+static void *larson_slots[LARSON_SLOTS];
+
+static void *larson_worker(void *arg)
+{
+    uint32_t seed = (uint32_t)(long)arg * 2654435761u + 1;
+
+    for (int i = 0; i < LARSON_OPS; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int slot = (seed >> 16) % LARSON_SLOTS;
+        size_t size = sizeof(size_t) + (seed >> 4) % (LARSON_MAX_REQUEST - sizeof(size_t) + 1);
+        size_t *pp = scaling_alloc->malloc(size);
+
+        *pp = size;
+        void *old = __atomic_exchange_n(&larson_slots[slot], pp, __ATOMIC_ACQ_REL);
+        if (old != NULL)
+            scaling_alloc->free(old);
+    }
+
+    return NULL;
+}
+
+static void larson_start(void)
+{
+}
+
+/* The slots fill up early in a run and stay full, so the live bytes at the end are the peak. */
+static size_t larson_finish(int threads)
+{
+    size_t live = 0;
+
+    for (int i = 0; i < LARSON_SLOTS; i++)
+    {
+        if (larson_slots[i] != NULL)
+        {
+            live += *(size_t *)larson_slots[i];
+            scaling_alloc->free(larson_slots[i]);
+            larson_slots[i] = NULL;
+        }
+    }
+
+    return live;
+}
+
+BENCH(threadtest)
+{
+    static const scaling_workload workload = {"threadtest", 1, threadtest_worker, threadtest_start, threadtest_finish};
+    scaling_bench(&workload);
+}
+
+BENCH(xmalloc)
+{
+    static const scaling_workload workload = {"xmalloc", 2, xmalloc_worker, xmalloc_start, xmalloc_finish};
+    scaling_bench(&workload);
+}
+
+BENCH(larson)
+{
+    static const scaling_workload workload = {"larson", 1, larson_worker, larson_start, larson_finish};
+    scaling_bench(&workload);
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "helper.h"
+
+#define SIZE_CLASS_BENCH_SAMPLES 2000
+#define SIZE_CLASS_BENCH_BATCH 1024
+
+/* The linear Fibonacci scan list_position() used before the lookup table, kept as a reference. */
+__attribute__((noinline)) static int list_position_linear(int num_bytes)
+{
+    int upper_limit[] = {1, 2, 3, 5, 8, 13, 21, 34};
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (upper_limit[i] * BLOCK_SZ >= num_bytes)
+            return i;
+    }
+
+    return 8;
+}
+
+static size_t size_class_inputs[SIZE_CLASS_BENCH_BATCH];
+
+static void fill_size_class_inputs(void)
+{
+    bench_srand(320);
+    for (int i = 0; i < SIZE_CLASS_BENCH_BATCH; i++)
+        size_class_inputs[i] = BLOCK_SZ * (1 + bench_rand() % 48); // Every class, including "> 34M"
+}
+
+/* Each sample is the time for a batch of SIZE_CLASS_BENCH_BATCH lookups over mixed sizes. */
+BENCH(size_class_table)
+{
+    static uint64_t samples[SIZE_CLASS_BENCH_SAMPLES];
+    volatile int sink = 0;
+
+    fill_size_class_inputs();
+    for (int s = 0; s < SIZE_CLASS_BENCH_SAMPLES; s++)
+    {
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < SIZE_CLASS_BENCH_BATCH; i++)
+            sink += list_position(size_class_inputs[i]);
+        samples[s] = bench_now_ns() - start;
+    }
+    bench_report("size_class_table", SIZE_CLASS_BENCH_BATCH, samples, SIZE_CLASS_BENCH_SAMPLES);
+    (void)sink;
+}
+
+BENCH(size_class_linear)
+{
+    static uint64_t samples[SIZE_CLASS_BENCH_SAMPLES];
+    volatile int sink = 0;
+
+    fill_size_class_inputs();
+    for (int s = 0; s < SIZE_CLASS_BENCH_SAMPLES; s++)
+    {
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < SIZE_CLASS_BENCH_BATCH; i++)
+            sink += list_position_linear(size_class_inputs[i]);
+        samples[s] = bench_now_ns() - start;
+    }
+    bench_report("size_class_linear", SIZE_CLASS_BENCH_BATCH, samples, SIZE_CLASS_BENCH_SAMPLES);
+    (void)sink;
+}
@@ -0,0 +1,47 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define SLAB_BENCH_OBJECTS 900
+
+/*
+ * Heap footprint of SLAB_BENCH_OBJECTS live objects of 8 to 48 bytes, with slabs off
+ * (param 0) and on.  slab_heap_bytes is how far the sfutil heap had to grow and
+ * slab_live_bytes the data actually requested; slab_malloc times each allocation.
+ */
+BENCH(slab_footprint)
+{
+    static uint64_t samples[SLAB_BENCH_OBJECTS];
+    static void *objects[SLAB_BENCH_OBJECTS];
+
+    for (int enabled = 0; enabled <= 1; enabled++)
+    {
+        uint64_t live = 0;
+
+        sf_mem_init();
+        sf_mallopt(SF_OPT_SLAB, enabled);
+        bench_srand(8);
+
+        for (int i = 0; i < SLAB_BENCH_OBJECTS; i++)
+        {
+            size_t size = 8 + bench_rand() % 41;
+            live += size;
+
+            uint64_t start = bench_now_ns();
+            objects[i] = sf_malloc(size);
+            samples[i] = bench_now_ns() - start;
+        }
+
+        bench_report("slab_malloc", enabled, samples, SLAB_BENCH_OBJECTS);
+        bench_report_value("slab_heap_bytes", enabled, (uint64_t)(sf_mem_end() - sf_mem_start()));
+        bench_report_value("slab_live_bytes", enabled, live);
+
+        for (int i = 0; i < SLAB_BENCH_OBJECTS; i++)
+            sf_free(objects[i]);
+
+        sf_mallopt(SF_OPT_SLAB, 0);
+        sf_mem_fini();
+    }
+}
@@ -0,0 +1,38 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define TCACHE_BENCH_SAMPLES 2000
+#define TCACHE_BENCH_BATCH 1000
+
+/*
+ * Back-to-back sf_malloc/sf_free pairs of a 32-byte object, with the thread cache off
+ * (param 0) and on.  Each sample times a batch of TCACHE_BENCH_BATCH pairs.
+ */
+BENCH(tcache_pair)
+{
+    static uint64_t samples[TCACHE_BENCH_SAMPLES];
+    int counts[] = {0, 16};
+
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_TCACHE_COUNT, counts[c]);
+        void *keep = sf_malloc(1); // Keeps the pair away from the wilderness
+
+        for (int s = 0; s < TCACHE_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            for (int i = 0; i < TCACHE_BENCH_BATCH; i++)
+                sf_free(sf_malloc(32));
+            samples[s] = bench_now_ns() - start;
+        }
+
+        sf_free(keep);
+        sf_mallopt(SF_OPT_TCACHE_COUNT, 0);
+        sf_mem_fini();
+        bench_report("tcache_pair", counts[c], samples, TCACHE_BENCH_SAMPLES);
+    }
+}
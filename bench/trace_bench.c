@@ -0,0 +1,40 @@
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define TRACE_BENCH_SAMPLES 2000
+#define TRACE_BENCH_PAIRS 100 // sf_malloc/sf_free pairs per sample
+
+/*
+ * Cost of recording: a sample is TRACE_BENCH_PAIRS sf_malloc/sf_free pairs of 100 bytes
+ * (param is 0 with tracing stopped, 1 with a trace running into /dev/null, so the flusher's
+ * writes cost nothing but the copy).  Only a build with -DSF_TRACE (make trace) can record;
+ * other builds print no rows.
+ */
+BENCH(trace)
+{
+    static uint64_t samples[TRACE_BENCH_SAMPLES];
+
+    for (int traced = 0; traced <= 1; traced++)
+    {
+        sf_mem_init();
+
+        if (traced && !sf_trace_start("/dev/null"))
+        {
+            sf_mem_fini();
+            return;
+        }
+
+        for (int s = 0; s < TRACE_BENCH_SAMPLES; s++)
+        {
+            uint64_t start = bench_now_ns();
+            for (int i = 0; i < TRACE_BENCH_PAIRS; i++)
+                sf_free(sf_malloc(100));
+            samples[s] = bench_now_ns() - start;
+        }
+
+        sf_trace_stop();
+        sf_mem_fini();
+        bench_report("trace_pairs", traced, samples, TRACE_BENCH_SAMPLES);
+    }
+}
@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "bench.h"
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define TRIM_BENCH_BLOCKS 50
+#define TRIM_BENCH_BLOCK_SZ 1000
+
+/*
+ * Burst then idle: TRIM_BENCH_BLOCKS written blocks of TRIM_BENCH_BLOCK_SZ bytes, all freed.
+ * trim_heap_resident and trim_process_rss report the footprint at each stage (param):
+ * 0 at the peak, 1 idle without trimming, 2 idle with SF_OPT_TRIM_THRESHOLD at 16 KiB,
+ * 3 idle after sf_malloc_trim(0).  trim_call times that sf_malloc_trim.
+ */
+BENCH(trim_burst)
+{
+    static void *blocks[TRIM_BENCH_BLOCKS];
+
+    for (int automatic = 0; automatic <= 1; automatic++)
+    {
+        sf_mem_init();
+        sf_mallopt(SF_OPT_TRIM_THRESHOLD, automatic ? 16384 : 0);
+        void *keep = sf_malloc(1); // Stays live through the idle phase, as long-lived data would
+
+        for (int i = 0; i < TRIM_BENCH_BLOCKS; i++)
+        {
+            blocks[i] = sf_malloc(TRIM_BENCH_BLOCK_SZ);
+            memset(blocks[i], 1, TRIM_BENCH_BLOCK_SZ);
+        }
+
+        if (!automatic)
+        {
+            bench_report_value("trim_heap_resident", 0, bench_heap_resident_bytes());
+            bench_report_value("trim_process_rss", 0, bench_process_rss_bytes());
+        }
+
+        for (int i = 0; i < TRIM_BENCH_BLOCKS; i++)
+            sf_free(blocks[i]);
+
+        bench_report_value("trim_heap_resident", 1 + automatic, bench_heap_resident_bytes());
+        bench_report_value("trim_process_rss", 1 + automatic, bench_process_rss_bytes());
+
+        if (!automatic)
+        {
+            uint64_t start = bench_now_ns();
+            sf_malloc_trim(0);
+            bench_report_value("trim_call", 0, bench_now_ns() - start);
+            bench_report_value("trim_heap_resident", 3, bench_heap_resident_bytes());
+            bench_report_value("trim_process_rss", 3, bench_process_rss_bytes());
+        }
+
+        sf_free(keep);
+        sf_mallopt(SF_OPT_TRIM_THRESHOLD, 0);
+        sf_mem_fini();
+    }
+}
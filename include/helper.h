@@ -1,7 +1,36 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "sfmm_ext.h"
+
 #define BLOCK_SZ  64
 #define INITIAL_PADDING BLOCK_SZ - (2 * sizeof(sf_header))
+#define SIZE_CLASS_UNITS 35 // Blocks of 35 or more units (more than 34M) share the last size class
+#define TCACHE_BINS 3        // Thread caches hold the exact-size classes M, 2M and 3M
+#define TCACHE_MAX_BLOCK (TCACHE_BINS * BLOCK_SZ)
+#define SF_ARENA_SIZE (256 * PAGE_SZ) // Address space reserved for each secondary arena
+#define SLAB_GRANULE 8
+#define SLAB_MAX_OBJECT 48          // Slabs hold objects of 8, 16, ..., 48 bytes
+#define SLAB_CLASSES (SLAB_MAX_OBJECT / SLAB_GRANULE)
+#define SLAB_HEADER_SZ 128          // sizeof(sf_slab) rounded up to whole 64-byte rows
+#define SF_GROW_MAX_PAGES 64          // Cap on the geometric growth step
+#define SF_LARGE_TABLE_SZ 1024       // Initial slots in the large-object table, which doubles as it fills
+#define LARGE_HEADER_SZ BLOCK_SZ      // Keeps large payloads on the same 64-byte alignment as heap blocks
+#define LARGE_TOMBSTONE ((void *)1)   // Marks a removed slot so probe chains stay intact
+#define SLAB_MAP_PAGES (SF_ARENA_SIZE / PAGE_SZ + 1) // Pages an arena can span, counting a partial first page
+#define SF_PURGE_TICKS 64             // Frees between scans for decayed blocks
+#define SF_INSERTION_MAX 32           // Largest batch sorted by insertion
+#define SF_RADIX_MAX 512              // Largest batch sorted by radix, bounded by its stack scratch
+#define HEAP_TAGS_SZ (INITIAL_PADDING + BLOCK_SZ + 2 * sizeof(sf_header)) // Padding, prologue and epilogue
+#define SF_LATENCY_THREADS 32         // Threads with latency histograms of their own; the rest share the last
+#define SF_LATENCY_CALIBRATE_MS 10     // How long the cycle counter is timed against the clock
+#define SF_TRACE_THREADS 64            // Threads traced at once; any more wait for an exited one's slot
+#define SF_TRACE_SLOT_FREE 0
+#define SF_TRACE_SLOT_OWNED 1
+#define SF_TRACE_SLOT_RETIRED 2        // Its thread exited; free once the flusher drains the ring
+#define SF_TRACE_RING_EVENTS 65536     // Per thread, 2.5 MiB: a flush interval of calls at over 6M a second
+#define WILDERNESS_TAGS_SZ (2 * sizeof(sf_header) + 2 * sizeof(sf_block *)) // prev_footer, header and links
 
-#define GET(p) (*(unsigned int *)(p))
+#define GET(p) (*(sf_header *)(p))
 #define GET_ALLOC(p) (GET(p) & THIS_BLOCK_ALLOCATED)
 #define IS_ALLOC(p) (GET(p) & THIS_BLOCK_ALLOCATED)
 #define IS_PREV_ALLOC(p) (GET_PREV_ALLOC(p) == 2)
@@ -9,20 +38,168 @@
 #define GET_BLOCK_SIZE(p) (GET(p) & BLOCK_SIZE_MASK)
 #define GET_BLOCK_FROM_PAYLOAD(pp) ((sf_block *)((void *)(pp) - (2 * sizeof(sf_header))))
 #define GET_NEXT_BLOCK(pp) (sf_block *)((void *)(pp) + GET_BLOCK_SIZE(&pp->header))
+#define GET_PREV_BLOCK(pp) (sf_block *)((void *)(pp) - GET_BLOCK_SIZE(&pp->prev_footer))
+// Word after the links of a free last-class block: when it was freed (ms, plus one), 0 once purged
+#define PURGE_STAMP(bp) (*(uint64_t *)((bp)->body.payload + 2 * sizeof(sf_block *)))
+
+/*
+ * Slot of the large-object table: a mapping made for one sf_malloc request, with its length.
+ */
+typedef struct sf_large
+{
+    void *base;
+    size_t length;
+} sf_large;
+
+/*
+ * Header of a one-page slab of objects of a single size. Bit i of free_map is set while
+ * object i is free; slabs with at least one free object are linked into their class's list.
+ */
+typedef struct sf_slab
+{
+    struct sf_slab *next;
+    struct sf_slab *prev;
+    unsigned short object_size;
+    unsigned short capacity;
+    unsigned short free_count;
+    uint64_t free_map[8];
+} sf_slab;
+
+/*
+ * One thread's trace events, mapped when the thread first records one. Only the thread moves
+ * head and only the flusher moves tail, each on a cache line of its own; an event between
+ * them is written before head passes it and read before tail does.
+ */
+typedef struct sf_trace_ring
+{
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t dropped; // Events that found the ring full since the flusher last looked
+    struct sf_trace_event events[SF_TRACE_RING_EVENTS] __attribute__((aligned(64)));
+} sf_trace_ring;
+
+/*
+ * A heap laid out by first_call_to_sf_malloc: its NUM_FREE_LISTS list heads, bit i of
+ * free_list_bitmap set while free_lists[i] is non-empty, and the sentinels at either end.
+ * epoch is bumped whenever the heap is laid out afresh, and when sf_mem_init is found to have
+ * discarded the last layout, so caches drop stale blocks.
+ */
+typedef struct sf_heap
+{
+    sf_block *free_lists;
+    unsigned int free_list_bitmap;
+    sf_block *prologue;
+    sf_block *epilogue;
+    unsigned long epoch;
+    pthread_mutex_t lock; // Held around every operation while SF_OPT_MULTITHREADED is on
+    void *mem_start;      // Secondary arenas only: their reservation and how much of it is in use
+    void *mem_end;
+    void *mem_limit;
+    int grow_pages;                                // Next step under SF_GROWTH_GEOMETRIC
+    void *released;                                // sfutil heap only: start of the wilderness tail already madvised away
+    int purge_ticks;                               // Frees since the last decay scan
+    struct sf_class_stats class_stats[NUM_FREE_LISTS]; // Counters for sf_get_stats, which fills in the free fields itself
+    size_t peak_heap;                              // Largest the heap has been since it was laid out
+    size_t grow_calls;                             // Pages added since then
+    void *zero_from;                               // Never handed out or tagged from here up, bar the epilogue
+    sf_slab *slabs[SLAB_CLASSES];                  // Slabs with a free object, by class
+    unsigned char slab_pages[(SLAB_MAP_PAGES + 7) / 8]; // Bit per page, set while the page is a slab
+} sf_heap;
+
+extern sf_heap main_heap;
 
-int list_position(int num_bytes);
-int first_call_to_sf_malloc();
-void init_lists();
-void add_epilogue();
+int list_position(size_t num_bytes);
+int first_call_to_sf_malloc(sf_heap *heap);
+void init_lists(sf_heap *heap);
+void add_epilogue(sf_heap *heap, sf_block *last_block);
 int round_to_64(size_t size);
-int search_empty_block(size_t size);
-void split_block(size_t size, int is_wilderness);
-int valid_pointer(void *pp);
-void add_block_to_list(sf_block *block_to_add, int is_wilderness);
-int remove_block(sf_block *block_to_remove);
-void coalesce();
+int search_empty_block(sf_heap *heap, size_t size, sf_block **found);
+sf_block *take_wilderness(sf_heap *heap, size_t size);
+sf_block *resize_in_place(sf_heap *heap, sf_block *bp, int rounded_size, int use_wilderness, int move_back);
+void split_block(sf_heap *heap, sf_block *bp, size_t size, int is_wilderness);
+int valid_pointer(sf_heap *heap, void *pp);
+int valid_owned_pointer(sf_heap *heap, void *pp);
+void add_block_to_list(sf_heap *heap, sf_block *block_to_add, int is_wilderness);
+int remove_block(sf_heap *heap, sf_block *block_to_remove);
+#ifdef DEBUG_FREE_LISTS
+int block_in_list(sf_heap *heap, sf_block *block_to_find);
+#endif
+sf_block *coalesce(sf_block *bp, sf_block *next_block);
 void count_num_blocks(int pos, int size);
-void clear_empty_blocks();
-void get_blocks();
-int is_power_of_2(int value);
-void remove_block_from_list();
\ No newline at end of file
+int is_power_of_2(size_t value);
+void *malloc_block(sf_heap *heap, int rounded_size);
+size_t carve_blocks(sf_heap *heap, int rounded_size, size_t n, void **out);
+void sort_addresses(void **ptrs, size_t n);
+void sift_address(void **ptrs, size_t root, size_t n);
+int radix_sort_addresses(void **ptrs, size_t n);
+void free_block(sf_heap *heap, sf_block *bp);
+void release_block(sf_heap *heap, sf_block *bp);
+void shrink_block(sf_heap *heap, sf_block *bp, int rounded_size);
+void *slab_malloc(sf_heap *heap, size_t size);
+void slab_free(sf_heap *heap, sf_slab *slab, void *pp);
+sf_slab *new_slab(sf_heap *heap, int object_size);
+void unlink_slab(sf_heap *heap, sf_slab *slab);
+sf_slab *slab_of(sf_heap *heap, void *pp);
+void set_slab_page(sf_heap *heap, sf_slab *slab, int is_slab);
+void init_slabs(sf_heap *heap);
+void *malloc_aligned_block(sf_heap *heap, int rounded_size, size_t align);
+int search_aligned_block(sf_heap *heap, size_t size, size_t align, sf_block **found, size_t *lead);
+void *large_malloc(size_t size);
+void *large_memalign(size_t size, size_t align);
+void *large_base(void *pp);
+int large_free(void *pp);
+void *large_realloc(void *pp, size_t rsize);
+size_t large_realloc_in_place(void *pp, size_t rsize);
+int is_large(void *pp);
+sf_large *large_find(void *base);
+int large_insert(void *base, size_t length);
+int large_rehash(size_t capacity);
+void lock_large();
+void unlock_large();
+size_t round_to_page(size_t size);
+size_t trim_wilderness(sf_heap *heap, size_t pad);
+void release_empty_slabs(sf_heap *heap);
+size_t purge_block(sf_block *bp);
+size_t purge_free_blocks(sf_heap *heap, uint64_t freed_before);
+uint64_t purge_clock_ms();
+void lock_heap(sf_heap *heap);
+void unlock_heap(sf_heap *heap);
+sf_heap *thread_heap();
+sf_heap *arena_at(int index);
+sf_heap *arena_of(void *pp);
+void *heap_start(sf_heap *heap);
+void *heap_end(sf_heap *heap);
+int heap_grow(sf_heap *heap, int pages);
+int latency_bucket(uint64_t ticks);
+uint64_t latency_bucket_limit(int bucket);
+uint64_t latency_ticks();
+double latency_ns_per_tick();
+void latency_record(int op, size_t size, uint64_t ticks);
+uint64_t entry_start();
+void record_entry(int op, size_t size, size_t align, void *pp, void *old_pp, uint64_t start);
+void record_batch(int op, size_t size, void **ptrs, size_t n, uint64_t start);
+void trace_record(int op, size_t size, size_t align, void *pp, void *old_pp, uint64_t begin, uint64_t end);
+int trace_claim_slot();
+void trace_create_key();
+void trace_thread_exit(void *arg);
+sf_trace_ring *trace_claim_ring();
+void *trace_flush_loop(void *arg);
+uint64_t trace_flush();
+int trace_write(int fd, const void *buf, size_t len);
+void *unwrapped_malloc(size_t size);
+void unwrapped_free(void *pp);
+void *unwrapped_realloc(void *pp, size_t rsize);
+void *unwrapped_memalign(size_t size, size_t align);
+void unwrapped_free_sized(void *pp, size_t size);
+size_t unwrapped_realloc_in_place(void *pp, size_t rsize);
+void *unwrapped_calloc(size_t nmemb, size_t size);
+size_t unwrapped_malloc_batch(size_t size, size_t n, void **out);
+void unwrapped_free_batch(void **ptrs, size_t n);
+void tcache_check_epoch();
+void *tcache_malloc(int rounded_size);
+int tcache_refill(int bin, int rounded_size);
+void tcache_free(sf_block *bp);
+void tcache_register();
+void tcache_create_key();
+void tcache_thread_exit(void *arg);
+void tcache_flush_bin(int bin, int count);
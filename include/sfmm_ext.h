@@ -0,0 +1,421 @@
+/**
+ * Extensions to the sf allocator that go beyond the interface in sfmm.h.
+ * sfmm.h is frozen, so everything added to the public API lives here.
+ */
+#ifndef SFMM_EXT_H
+#define SFMM_EXT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Tuning parameters accepted by sf_mallopt.
+ *
+ * SF_OPT_TCACHE_COUNT  Number of blocks each thread may keep cached per small size class
+ *                      (the exact-size classes M, 2M and 3M), from 0 to SF_TCACHE_MAX_COUNT.
+ *                      0, the default, turns the thread caches off so that every free block
+ *                      is visible in sf_free_list_heads.
+ *
+ * SF_OPT_MULTITHREADED 1 makes sf_malloc, sf_free, sf_realloc and sf_memalign safe to call
+ *                      from several threads at once by serializing them on a heap lock.
+ *                      0, the default, skips the lock for single-threaded programs.  Switch
+ *                      it on before a second thread starts using the allocator.
+ *
+ * SF_OPT_ARENA_COUNT   Number of arenas, from 1 to SF_MAX_ARENAS, that threads are spread
+ *                      over.  Each arena has its own free lists, wilderness and lock; arena 0
+ *                      is the sfutil heap and the others are reserved with mmap on first use.
+ *                      A freed block always returns to the arena it came from.  1, the
+ *                      default, keeps every block in sf_free_list_heads.  Arenas only pay off
+ *                      together with SF_OPT_MULTITHREADED.
+ *
+ * SF_OPT_ARENA_POLICY  How a thread picks its arena: SF_ARENA_ROUND_ROBIN, the default, hands
+ *                      each new thread the next arena in turn; SF_ARENA_BY_CPU uses the arena
+ *                      of the CPU the thread is running on at the time of each call.
+ *
+ * SF_OPT_SLAB          1 serves requests of 1 to 48 bytes from one-page slabs of 8, 16, ...,
+ *                      48-byte objects with no per-object header.  0, the default, gives every
+ *                      request a block of its own.  sf_free and sf_realloc accept slab objects
+ *                      whichever way the option is set.
+ *
+ * SF_OPT_REALLOC_WILDERNESS  1 lets sf_realloc grow a block that borders the wilderness in
+ *                      place, extending the heap if need be.  0, the default, moves such a
+ *                      block instead, leaving the wilderness to later requests.  Growth into
+ *                      any other free neighbour happens in place either way.
+ *
+ * SF_OPT_MMAP_THRESHOLD  Requests of at least this many bytes get a mapping of their own
+ *                      instead of a heap block.  sf_free unmaps them right away and
+ *                      sf_realloc resizes them with mremap, without copying.  0, the default,
+ *                      serves every request from the heap.
+ *
+ * SF_OPT_GROWTH_POLICY How far the heap grows when the wilderness is too small.
+ *                      SF_GROWTH_EXACT, the default, grows by just the pages the request is
+ *                      short of.  SF_GROWTH_GEOMETRIC grows by at least a step that starts at
+ *                      one page and doubles with each growth, up to 64 pages, so a heap that
+ *                      keeps growing takes fewer, larger steps.
+ *
+ * SF_OPT_TRIM_THRESHOLD  When a free leaves the wilderness larger than this many bytes, its
+ *                      tail pages are handed back to the system.  0, the default, never trims
+ *                      on its own; sf_malloc_trim still works.
+ *
+ * SF_OPT_PURGE_DECAY   What happens to the pages inside large free blocks in the middle of
+ *                      the heap (the last size class).  -1, the default, leaves them resident.
+ *                      0 hands the page-aligned interior of such a block back to the system as
+ *                      soon as it is freed.  A positive value purges blocks that have stayed
+ *                      free for at least that many milliseconds; the check runs every few
+ *                      frees, so a heap that goes idle keeps its pages until the next free or
+ *                      sf_malloc_trim.  Block headers, links and footers always stay in place.
+ *
+ * SF_OPT_FIT_POLICY    Which free block a request is placed in.  The search always starts at
+ *                      the request's size class and moves up; the policy decides what to take
+ *                      from the first class that can serve it.  SF_FIT_FIRST, the default,
+ *                      takes the first block that fits, most recently freed first.
+ *                      SF_FIT_BEST takes the smallest block in the class that fits.
+ *                      SF_FIT_ADDRESS keeps every class sorted by address and takes the lowest
+ *                      block that fits; blocks freed before it was set stay where they are.
+ *                      SF_FIT_GOOD takes the smallest of the first SF_OPT_FIT_CANDIDATES
+ *                      blocks that fit.  Best and good fit stop early on an exact fit.
+ *
+ * SF_OPT_FIT_CANDIDATES  How many fitting blocks SF_FIT_GOOD compares, at least 1 (default 4).
+ */
+#define SF_OPT_TCACHE_COUNT 1
+#define SF_OPT_MULTITHREADED 2
+#define SF_OPT_ARENA_COUNT 3
+#define SF_OPT_ARENA_POLICY 4
+#define SF_OPT_SLAB 5
+#define SF_OPT_REALLOC_WILDERNESS 6
+#define SF_OPT_MMAP_THRESHOLD 7
+#define SF_OPT_GROWTH_POLICY 8
+#define SF_OPT_TRIM_THRESHOLD 9
+#define SF_OPT_PURGE_DECAY 10
+#define SF_OPT_FIT_POLICY 11
+#define SF_OPT_FIT_CANDIDATES 12
+
+#define SF_MAX_ARENAS 8
+#define SF_ARENA_ROUND_ROBIN 0
+#define SF_ARENA_BY_CPU 1
+#define SF_GROWTH_EXACT 0
+#define SF_GROWTH_GEOMETRIC 1
+#define SF_FIT_FIRST 0
+#define SF_FIT_BEST 1
+#define SF_FIT_ADDRESS 2
+#define SF_FIT_GOOD 3
+
+#define SF_TCACHE_MAX_COUNT 64
+
+/*
+ * Adjusts one of the allocator's tuning parameters.
+ *
+ * @param param One of the SF_OPT_* constants.
+ * @param value The new value for the parameter.
+ *
+ * @return 1 if the parameter was changed, 0 if the parameter or value is not valid.
+ */
+int sf_mallopt(int param, int value);
+
+/*
+ * Resizes the block at pp without ever moving it.  Growth absorbs a free successor or, at the
+ * top of the heap, the wilderness (extending the heap as needed); a shrink splits off the tail.
+ * A large object's mapping grows only into free address space right after it, and shrinks a
+ * page at a time.
+ *
+ * @param pp Pointer to an allocated payload, as for sf_realloc.
+ * @param rsize The size wanted.  0 leaves the block as it is.
+ *
+ * @return The usable size of the block afterwards: at least rsize on success, the unchanged
+ * size if it could not grow in place.
+ */
+size_t sf_realloc_in_place(void *pp, size_t rsize);
+
+/*
+ * Frees a block whose requested size the caller knows, as sf_free does.  A block that is
+ * plainly what the size says (its header matches) skips the checks sf_free makes to find out
+ * what kind of pointer it was given; anything else falls back to sf_free.
+ *
+ * @param pp The pointer to free.
+ * @param size The size last passed to sf_malloc, sf_realloc or sf_memalign for pp, or any
+ * size up to what sf_malloc_usable_size reported for it.
+ */
+void sf_free_sized(void *pp, size_t size);
+
+/*
+ * Reports how many bytes of the block at pp the caller may use, which is at least the size
+ * requested and often more: heap blocks are rounded up to whole 64-byte rows.
+ *
+ * @param pp An allocated payload, or NULL.
+ *
+ * @return The usable size, or 0 for NULL.  An invalid pointer aborts, as it would in sf_free.
+ */
+size_t sf_malloc_usable_size(void *pp);
+
+/*
+ * Reports whether pp lies in memory the allocator manages: the sfutil heap, an arena's
+ * reservation or a large object's mapping.  It does not check that pp is a live block; it
+ * lets code that mixes allocators tell whose pointer it was given before freeing it.
+ *
+ * @return 1 if pp is the allocator's, 0 otherwise.
+ */
+int sf_owns(void *pp);
+
+/*
+ * Handlers for pthread_atfork, for programs that fork while other threads may be inside the
+ * allocator: sf_fork_prepare takes every lock the allocator has, sf_fork_parent releases them
+ * and sf_fork_child gives the child fresh ones, so its first allocation cannot block on a
+ * lock held by a thread that did not survive the fork.  Register them once, as in
+ * pthread_atfork(sf_fork_prepare, sf_fork_parent, sf_fork_child).
+ */
+void sf_fork_prepare();
+void sf_fork_parent();
+void sf_fork_child();
+
+/*
+ * Allocates zeroed memory for an array of nmemb elements of size bytes each.  Memory that
+ * has never been handed out since the system zeroed it (fresh arena pages, pages released by
+ * trimming, large mappings) is not cleared again.
+ *
+ * @param nmemb The number of elements.
+ * @param size The size of each element.
+ *
+ * @return A pointer to nmemb * size zeroed bytes, or NULL if either is 0 or the request
+ * cannot be satisfied.  If nmemb * size overflows or memory runs out, sf_errno is set to
+ * ENOMEM.
+ */
+void *sf_calloc(size_t nmemb, size_t size);
+
+/*
+ * Allocates n blocks of size bytes with one trip through the heap: the blocks are carved back
+ * to back from a single free region when one large enough exists (growing the heap for it if
+ * need be), and from as few regions as possible otherwise.
+ *
+ * @param size The number of bytes requested for each block.
+ * @param n The number of blocks requested.
+ * @param out Receives the payload pointers.
+ *
+ * @return The number of blocks allocated, which is less than n only if the heap ran out of
+ * memory, in which case sf_errno is set to ENOMEM and out holds the blocks that were made.
+ */
+size_t sf_malloc_batch(size_t size, size_t n, void **out);
+
+/*
+ * Frees n blocks, as if by sf_free on each.  The pointers are sorted by address first (ptrs is
+ * reordered in place), so blocks that neighbour one another are merged and coalesced once.
+ *
+ * @param ptrs The payload pointers to free.  Each must be valid for sf_free.
+ * @param n The number of pointers.
+ */
+void sf_free_batch(void **ptrs, size_t n);
+
+/*
+ * Hands as much free memory back to the system as possible: flushes the calling thread's
+ * cache, releases empty slabs, purges the interior pages of large free blocks whatever
+ * SF_OPT_PURGE_DECAY says, and trims the wilderness of every arena, keeping pad bytes of
+ * each wilderness in place for future requests.  Secondary arenas shrink; the sfutil heap
+ * cannot, so its wilderness pages are released with madvise and come back zeroed on reuse.
+ *
+ * @param pad Bytes to leave untouched at the start of each wilderness.
+ *
+ * @return 1 if any memory was released, 0 otherwise.
+ */
+int sf_malloc_trim(size_t pad);
+
+#define SF_STATS_CLASSES 10 // One per free list (NUM_FREE_LISTS in sfmm.h), the last being the wilderness
+
+/*
+ * Activity and free memory of one free list, summed over every arena.  mallocs and frees
+ * count heap blocks by the list their size belongs to, handed out and given back: a block
+ * that a thread cache or a slab took from the heap counts once when it leaves the heap, not
+ * on every request it serves.  splits counts blocks of the list cut in two, free ones to serve
+ * a request and allocated ones shrunk in place; coalesces counts merges of neighbouring free
+ * blocks by the list the merged block lands in.  free_blocks and free_bytes describe the list
+ * right now.
+ */
+struct sf_class_stats {
+    size_t mallocs;
+    size_t frees;
+    size_t splits;
+    size_t coalesces;
+    size_t free_blocks;
+    size_t free_bytes;
+};
+
+/*
+ * Allocator-wide figures, summed over every arena.  Blocks held by thread caches and whole
+ * slab pages count as live.  heap_bytes includes wilderness pages that trimming released but
+ * the sfutil heap could not give up.  fragmentation is 1 - (largest free block / free bytes):
+ * 0 while all free memory is one block, approaching 1 as it splinters.
+ */
+struct sf_stats {
+    size_t total_bytes;      // heap_bytes + large_bytes
+    size_t heap_bytes;       // Current size of every heap
+    size_t large_bytes;      // Mappings of large objects, headers and page rounding included
+    size_t live_bytes;       // Allocated heap blocks, headers included, plus large_bytes
+    size_t free_bytes;       // Free heap blocks, the wildernesses included
+    size_t peak_heap_bytes;  // Sum of the largest size each heap has reached
+    size_t grow_calls;       // Pages added to the heaps: sf_mem_grow calls, or reservation pages for an arena
+    size_t large_mallocs;
+    size_t large_frees;
+    double fragmentation;
+    struct sf_class_stats classes[SF_STATS_CLASSES];
+};
+
+/*
+ * Copies the allocator's counters into stats and fills in the free memory figures, walking
+ * the free lists of each arena under its lock, so it is safe to call while other threads
+ * allocate.  The counters cost one increment under a lock the heap already holds.  They start
+ * over, with the heap, whenever sf_mem_init resets the sfutil heap; large-object counts do not.
+ */
+void sf_get_stats(struct sf_stats *stats);
+
+/*
+ * The entry points that the latency histograms and the trace recorder watch.
+ */
+#define SF_OP_MALLOC 0
+#define SF_OP_FREE 1
+#define SF_OP_REALLOC 2
+#define SF_OP_MEMALIGN 3
+#define SF_OP_FREE_SIZED 4
+#define SF_OP_REALLOC_IN_PLACE 5
+#define SF_OP_CALLOC 6
+#define SF_OP_MALLOC_BATCH 7
+#define SF_OP_FREE_BATCH 8
+#define SF_OP_COUNT 9
+
+/*
+ * Latency of the public entry points, recorded only when the allocator is built with
+ * -DSF_LATENCY (make latency); otherwise nothing is timed and the calls below see empty
+ * histograms.  Each thread times its own sf_malloc, sf_free, sf_realloc and sf_memalign calls,
+ * and its calls to the sf_free_sized, sf_realloc_in_place, sf_calloc, sf_malloc_batch and
+ * sf_free_batch above, with the cycle counter into histograms of its own, one per operation
+ * and size class: the class of the size requested, or for sf_free of the block's usable size,
+ * by the free lists' bounds.  A batch call is one sample, in the class of its size or, for
+ * sf_free_batch, of its first block.
+ *
+ * Buckets are log-linear: values below SF_LATENCY_SUB_BUCKETS ticks get a bucket each, and
+ * every power of two above that is cut into SF_LATENCY_SUB_BUCKETS equal buckets, so a
+ * percentile is accurate to within 1/SF_LATENCY_SUB_BUCKETS of its value.
+ */
+#define SF_LATENCY_SUB_BUCKETS 8
+#define SF_LATENCY_MAX_EXP 36 // Ticks of 2^36 and beyond, tens of seconds, share the last bucket
+#define SF_LATENCY_BUCKETS ((SF_LATENCY_MAX_EXP - 2) * SF_LATENCY_SUB_BUCKETS)
+
+struct sf_latency_histogram {
+    size_t counts[SF_LATENCY_BUCKETS];
+};
+
+struct sf_latency {
+    struct sf_latency_histogram ops[SF_OP_COUNT][SF_STATS_CLASSES];
+};
+
+/*
+ * Adds the histograms of every thread that has called the allocator, including threads that
+ * have exited, to into.  Zero into first for a fresh total.
+ */
+void sf_latency_merge(struct sf_latency *into);
+
+/*
+ * Clears the histograms of every thread.  Calls still in progress may land in either.
+ */
+void sf_latency_reset();
+
+/*
+ * Returns the latency in nanoseconds below which a fraction q (0 to 1) of the histogram's
+ * samples fall, as the upper bound of the bucket it lands in, or 0 if it is empty.
+ */
+double sf_latency_percentile(const struct sf_latency_histogram *histogram, double q);
+
+/*
+ * Writes one CSV row "op,class,count,p50_ns,p99_ns,p999_ns" to out for each non-empty
+ * histogram in latency, after a header row.
+ */
+void sf_latency_dump(const struct sf_latency *latency, FILE *out);
+
+/*
+ * Allocation trace, recorded only when the allocator is built with -DSF_TRACE (make trace)
+ * and only between sf_trace_start and sf_trace_stop.  Each thread appends an event for each
+ * of its calls to the entry points the latency histograms watch, and one for each block of a
+ * batch call, to a ring of its own, without locking; a background thread drains the rings
+ * into the trace file every SF_TRACE_FLUSH_MS.  A thread whose ring is full drops the event
+ * and counts it instead of waiting.  Rings are a fixed number of slots, which an exiting
+ * thread hands on once its ring is drained; a call made while every slot is taken is dropped
+ * and counted too.  bin/sftrace prints or converts a trace.
+ *
+ * The file is an sf_trace_header followed by chunks, each an sf_trace_chunk and count events
+ * of one thread in the order it made them.  Pointers are recorded as addresses, which the
+ * decoder turns into ids; timestamps are cycle counter ticks, which ns_per_tick converts.
+ */
+#define SF_TRACE_MAGIC "SFTRACE2"
+#define SF_TRACE_FLUSH_MS 10
+#define SF_TRACE_NO_THREAD 0xffffffffU
+
+struct sf_trace_header {
+    char magic[8];         // SF_TRACE_MAGIC, without its terminator
+    double ns_per_tick;
+    uint64_t start_ticks;  // When sf_trace_start was called
+};
+
+struct sf_trace_chunk {
+    uint32_t thread;       // Small integer, the same for every chunk of one thread; SF_TRACE_NO_THREAD
+                           // for a chunk that only counts calls made with no ring free
+    uint32_t count;        // Events that follow
+    uint64_t dropped;      // Events the thread dropped since its previous chunk
+};
+
+/*
+ * One call.  info packs the size asked for in its low 48 bits (0 for the frees), log2 of the
+ * alignment in the next 8 (sf_memalign only) and the SF_OP_* operation in the top 8.  A block
+ * is given up when the call that frees it begins and taken when the call that returns it
+ * ends, so ordering frees by begin_ticks and the rest by ticks never shows one address live
+ * twice.
+ */
+struct sf_trace_event {
+    uint64_t begin_ticks;  // When the call was entered
+    uint64_t ticks;        // When the call returned
+    uint64_t pp;           // Pointer returned, or freed; 0 for a failed request
+    uint64_t old_pp;       // The reallocs' argument, 0 for the other operations
+    uint64_t info;
+};
+
+#define SF_TRACE_INFO(op, size, align_shift) ((uint64_t)(op) << 56 | (uint64_t)(align_shift) << 48 | ((uint64_t)(size) & 0xffffffffffffULL))
+#define SF_TRACE_OP(info) ((int)((info) >> 56))
+#define SF_TRACE_ALIGN_SHIFT(info) ((int)((info) >> 48 & 0xff))
+#define SF_TRACE_SIZE(info) ((info) & 0xffffffffffffULL)
+
+/*
+ * Creates or truncates the file at path, writes the trace header and starts recording.
+ *
+ * @return 1 if tracing started, 0 if it was already on, the file could not be created, or
+ * the allocator was built without -DSF_TRACE.
+ */
+int sf_trace_start(const char *path);
+
+/*
+ * Stops recording, waits for every recorded event to reach the file and closes it.  Calls
+ * that were already under way may be left out.
+ */
+void sf_trace_stop();
+
+/*
+ * Counters kept by the calling thread's cache.  A malloc hit is served straight from the
+ * cache; a miss refills the cache with a batch of blocks from the heap first.  A free hit
+ * lands in the cache; a free miss finds the bin full and flushes half of it to the heap.
+ */
+struct sf_tcache_stats {
+    size_t malloc_hits;
+    size_t malloc_misses;
+    size_t free_hits;
+    size_t free_misses;
+    size_t refills;
+    size_t flushes;
+};
+
+/*
+ * Copies the calling thread's cache counters into stats.
+ */
+void sf_tcache_stats(struct sf_tcache_stats *stats);
+
+/*
+ * Returns every block cached by the calling thread beyond the current SF_OPT_TCACHE_COUNT
+ * bound to the heap, where it is coalesced as if it had just been freed.
+ */
+void sf_tcache_flush();
+
+#endif
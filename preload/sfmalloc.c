@@ -0,0 +1,341 @@
+/**
+ * malloc, free and the rest of the C library's allocation functions on top of the sf
+ * allocator, for running unmodified programs on it:
+ *   LD_PRELOAD=bin/libsfmalloc.so program
+ *
+ * sfutil's object file is not position independent and caps the heap at 16 pages, so the
+ * library brings its own sfutil in its place: sf_mem_init reserves SF_PRELOAD_HEAP_SIZE of
+ * address space and sf_mem_grow hands it out a page at a time.  The allocator is set up on
+ * the first allocation, multi-threaded and with large requests mapped as glibc would map
+ * them.  A call made from inside that setup (dlsym may allocate) is served from a static
+ * bootstrap buffer whose blocks are never reused.
+ *
+ * Requests sf cannot serve fall through to glibc's own allocator, and free, realloc and
+ * malloc_usable_size ask sf_owns whose block they were given, so pointers from glibc (from
+ * the fallback, or from before the library was loaded) are handed back to it.
+ */
+#define _GNU_SOURCE // RTLD_NEXT, MAP_ANONYMOUS, MAP_NORESERVE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define SF_PRELOAD_EXPORT __attribute__((visibility("default")))
+
+#define SF_PRELOAD_HEAP_SIZE (1UL << 32)         // Address space reserved for the heap
+#define SF_PRELOAD_MAX_REQUEST (1UL << 30)       // Larger requests go straight to glibc
+#define SF_PRELOAD_MMAP_THRESHOLD (128 * 1024)   // glibc's default M_MMAP_THRESHOLD
+#define SF_PRELOAD_BOOTSTRAP_SZ (64 * 1024)
+#define SF_PRELOAD_ALIGN 64                      // Every sf payload, heap or mapped, is aligned to this
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *pp, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *pp);
+
+/*
+ * The heap: one reservation, backed by the kernel page by page as it is first touched.
+ * sf_mem_grow runs under the heap lock, like every other call into the heap.
+ */
+static char *heap_start, *heap_end;
+
+void sf_mem_init()
+{
+    if (heap_start != NULL)
+        return;
+
+    void *base = mmap(NULL, SF_PRELOAD_HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base != MAP_FAILED) // Otherwise sf_mem_grow fails and every request goes to glibc
+        heap_start = heap_end = base;
+}
+
+void sf_mem_fini()
+{
+    // The heap lives as long as the process
+}
+
+void *sf_mem_grow()
+{
+    if (heap_start == NULL || heap_end - heap_start + PAGE_SZ > SF_PRELOAD_HEAP_SIZE)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    void *page = heap_end;
+    __atomic_store_n(&heap_end, heap_end + PAGE_SZ, __ATOMIC_RELEASE); // sf_owns reads it unlocked
+    return page;
+}
+
+void *sf_mem_start()
+{
+    return heap_start;
+}
+
+void *sf_mem_end()
+{
+    return __atomic_load_n(&heap_end, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Bootstrap buffer, only ever used by the thread running the setup.  Each block is preceded
+ * by its size and starts on an SF_PRELOAD_ALIGN boundary; the buffer is zero and nothing in
+ * it is reused, so every block is zeroed as calloc requires.
+ */
+static char bootstrap[SF_PRELOAD_BOOTSTRAP_SZ] __attribute__((aligned(SF_PRELOAD_ALIGN)));
+static size_t bootstrap_used;
+
+static int is_bootstrap(void *pp)
+{
+    return (char *)pp >= bootstrap && (char *)pp < bootstrap + SF_PRELOAD_BOOTSTRAP_SZ;
+}
+
+static void *bootstrap_malloc(size_t size, size_t align)
+{
+    if (align < SF_PRELOAD_ALIGN)
+        align = SF_PRELOAD_ALIGN;
+
+    size_t offset = (bootstrap_used + sizeof(size_t) + align - 1) & ~(align - 1);
+
+    if (offset > SF_PRELOAD_BOOTSTRAP_SZ || size > SF_PRELOAD_BOOTSTRAP_SZ - offset)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bootstrap_used = offset + size;
+    ((size_t *)(bootstrap + offset))[-1] = size;
+    return bootstrap + offset;
+}
+
+static size_t bootstrap_size(void *pp)
+{
+    return ((size_t *)pp)[-1];
+}
+
+static int preload_ready;
+static __thread int preload_initializing;
+static pthread_mutex_t preload_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t (*system_usable_size)(void *pp);
+
+/*
+ * A program that forks while another thread is allocating must not leave the child waiting
+ * on a lock that thread held: preload_lock is taken first, since the setup calls into the
+ * allocator while holding it.
+ */
+static void preload_fork_prepare(void)
+{
+    pthread_mutex_lock(&preload_lock);
+    sf_fork_prepare();
+}
+
+static void preload_fork_parent(void)
+{
+    sf_fork_parent();
+    pthread_mutex_unlock(&preload_lock);
+}
+
+static void preload_fork_child(void)
+{
+    sf_fork_child();
+    pthread_mutex_init(&preload_lock, NULL);
+}
+
+/*
+ * Sets the allocator up on the first call.  Returns 0 to a call made from inside the setup,
+ * which has to be served from the bootstrap buffer; other threads wait for the setup instead.
+ */
+static int preload_init(void)
+{
+    if (__atomic_load_n(&preload_ready, __ATOMIC_ACQUIRE))
+        return 1;
+
+    if (preload_initializing)
+        return 0;
+
+    pthread_mutex_lock(&preload_lock);
+
+    if (!preload_ready)
+    {
+        preload_initializing = 1;
+
+        sf_mem_init();
+        sf_mallopt(SF_OPT_MULTITHREADED, 1);
+        sf_mallopt(SF_OPT_MMAP_THRESHOLD, SF_PRELOAD_MMAP_THRESHOLD);
+        system_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size");
+        pthread_atfork(preload_fork_prepare, preload_fork_parent, preload_fork_child);
+
+        preload_initializing = 0;
+        __atomic_store_n(&preload_ready, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&preload_lock);
+    return 1;
+}
+
+static int is_power_of_2(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static void *aligned_malloc(size_t align, size_t size)
+{
+    if (!preload_init())
+        return bootstrap_malloc(size, align);
+
+    void *pp = NULL;
+
+    if (size == 0)
+        size = 1;
+
+    if (size < SF_PRELOAD_MAX_REQUEST)
+        pp = align <= SF_PRELOAD_ALIGN ? sf_malloc(size) : sf_memalign(size, align);
+
+    return pp != NULL ? pp : __libc_memalign(align, size);
+}
+
+SF_PRELOAD_EXPORT void *malloc(size_t size)
+{
+    if (!preload_init())
+        return bootstrap_malloc(size, 0);
+
+    void *pp = size < SF_PRELOAD_MAX_REQUEST ? sf_malloc(size == 0 ? 1 : size) : NULL;
+
+    return pp != NULL ? pp : __libc_malloc(size);
+}
+
+SF_PRELOAD_EXPORT void free(void *pp)
+{
+    if (pp == NULL || is_bootstrap(pp))
+        return;
+
+    if (sf_owns(pp))
+        sf_free(pp);
+    else
+        __libc_free(pp);
+}
+
+SF_PRELOAD_EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+
+    if (__builtin_mul_overflow(nmemb, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (!preload_init())
+        return bootstrap_malloc(total, 0);
+
+    void *pp = total < SF_PRELOAD_MAX_REQUEST ? sf_calloc(1, total == 0 ? 1 : total) : NULL;
+
+    return pp != NULL ? pp : __libc_calloc(nmemb, size);
+}
+
+SF_PRELOAD_EXPORT void *realloc(void *pp, size_t size)
+{
+    if (pp == NULL)
+        return malloc(size);
+
+    if (size == 0)
+    {
+        free(pp);
+        return NULL;
+    }
+
+    if (!sf_owns(pp) && !is_bootstrap(pp))
+        return __libc_realloc(pp, size);
+
+    void *moved = NULL;
+
+    if (!is_bootstrap(pp) && size < SF_PRELOAD_MAX_REQUEST && (moved = sf_realloc(pp, size)) != NULL)
+        return moved;
+
+    // A bootstrap block, or one sf cannot grow: copy it to wherever malloc finds room
+    size_t old_size = is_bootstrap(pp) ? bootstrap_size(pp) : sf_malloc_usable_size(pp);
+
+    if ((moved = malloc(size)) == NULL)
+        return NULL;
+
+    memcpy(moved, pp, old_size < size ? old_size : size);
+    free(pp);
+    return moved;
+}
+
+SF_PRELOAD_EXPORT void *reallocarray(void *pp, size_t nmemb, size_t size)
+{
+    size_t total;
+
+    if (__builtin_mul_overflow(nmemb, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(pp, total);
+}
+
+SF_PRELOAD_EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (!is_power_of_2(align) || align % sizeof(void *) != 0)
+        return EINVAL;
+
+    void *pp = aligned_malloc(align, size);
+
+    if (pp == NULL)
+        return ENOMEM;
+
+    *memptr = pp;
+    return 0;
+}
+
+SF_PRELOAD_EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    if (!is_power_of_2(align))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return aligned_malloc(align, size);
+}
+
+SF_PRELOAD_EXPORT void *memalign(size_t align, size_t size)
+{
+    if (!is_power_of_2(align)) // glibc rounds other alignments up to a power of two
+        align = align <= 1 ? 1 : (size_t)1 << (64 - __builtin_clzl(align - 1));
+
+    return aligned_malloc(align, size);
+}
+
+SF_PRELOAD_EXPORT void *valloc(size_t size)
+{
+    return aligned_malloc(PAGE_SZ, size);
+}
+
+SF_PRELOAD_EXPORT void *pvalloc(size_t size)
+{
+    return aligned_malloc(PAGE_SZ, (size + PAGE_SZ - 1) & ~(size_t)(PAGE_SZ - 1));
+}
+
+SF_PRELOAD_EXPORT size_t malloc_usable_size(void *pp)
+{
+    if (pp == NULL)
+        return 0;
+
+    if (is_bootstrap(pp))
+        return bootstrap_size(pp);
+
+    if (sf_owns(pp))
+        return sf_malloc_usable_size(pp);
+
+    return system_usable_size != NULL ? system_usable_size(pp) : 0;
+}
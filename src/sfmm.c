@@ -3,6 +3,7 @@
  * Do not submit your assignment with a main function in this file.
  * If you submit with a main function in this file, you will get a zero.
  */
+#define _GNU_SOURCE // pthread mutexes, MAP_ANONYMOUS and sched_getcpu under -std=c99
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,514 +11,2993 @@
 #include "sfmm.h"
 
 #include <errno.h> // Added so sf_errno could be set to ENOMEM
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 #include "helper.h"
+#include "sfmm_ext.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc for the latency histograms and trace timestamps
+#endif
+
+#if SF_STATS_CLASSES != NUM_FREE_LISTS
+#error "struct sf_stats needs an entry per free list"
+#endif
+
+#if defined(SF_LATENCY) || defined(SF_TRACE)
+// The public entry points are compiled under these names and wrapped by instrumented ones at
+// the end of the file; calls between them go unwatched, so each caller-visible call counts once
+#define sf_malloc unwrapped_malloc
+#define sf_free unwrapped_free
+#define sf_realloc unwrapped_realloc
+#define sf_memalign unwrapped_memalign
+#define sf_free_sized unwrapped_free_sized
+#define sf_realloc_in_place unwrapped_realloc_in_place
+#define sf_calloc unwrapped_calloc
+#define sf_malloc_batch unwrapped_malloc_batch
+#define sf_free_batch unwrapped_free_batch
+#endif
+
+/*
+ * Everything the allocator knows about the sfutil heap. The functions below keep per-call
+ * state in locals and reach the heap only through this struct, so with the lock held any
+ * thread can run them.
+ */
+sf_heap main_heap = {
+    .free_lists = sf_free_list_heads,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int heap_locking;          // SF_OPT_MULTITHREADED: public entry points serialize on the heap lock
+int tcache_count;          // SF_OPT_TCACHE_COUNT: blocks each thread may cache per bin, 0 turns caching off
+int arena_count = 1;       // SF_OPT_ARENA_COUNT: arenas threads are spread over, the first being main_heap
+int arena_policy;          // SF_OPT_ARENA_POLICY: SF_ARENA_ROUND_ROBIN or SF_ARENA_BY_CPU
+int realloc_wilderness;    // SF_OPT_REALLOC_WILDERNESS: sf_realloc may grow a block at the top of the heap in place
+int slab_enabled;          // SF_OPT_SLAB: requests of up to SLAB_MAX_OBJECT bytes are carved from slabs
+int growth_policy;         // SF_OPT_GROWTH_POLICY: SF_GROWTH_EXACT or SF_GROWTH_GEOMETRIC
+size_t trim_threshold;     // SF_OPT_TRIM_THRESHOLD: a wilderness freed past this many bytes is trimmed, 0 for never
+size_t mmap_threshold;     // SF_OPT_MMAP_THRESHOLD: requests of at least this many bytes get a mapping of their own, 0 for never
+int fit_policy;            // SF_OPT_FIT_POLICY: SF_FIT_FIRST, SF_FIT_BEST, SF_FIT_ADDRESS or SF_FIT_GOOD
+int fit_candidates = 4;    // SF_OPT_FIT_CANDIDATES: fitting blocks SF_FIT_GOOD compares within a class
+int purge_decay_ms = -1;   // SF_OPT_PURGE_DECAY: -1 never purges free blocks, 0 purges them on free, otherwise after this long
+
+/*
+ * Table of live large objects, keyed by mapping address with linear probing. Tombstones keep
+ * probe chains intact across removals until the next rehash clears them; the table is mapped
+ * on first use and doubles once live entries fill half of it. large_count lets sf_free skip
+ * the table while it is empty.
+ */
+static sf_large *large_table;
+static size_t large_capacity;              // Slots in large_table, a power of two
+static size_t large_tombstones;
+static int large_count;
+static size_t large_bytes;                 // Sum of the lengths in the table
+static size_t large_mallocs, large_frees;  // For sf_get_stats, under large_lock like the table
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Secondary arenas, created on first use and never torn down. Each one runs the same heap
+ * layout as main_heap inside its own SF_ARENA_SIZE reservation.
+ */
+static sf_heap arenas[SF_MAX_ARENAS - 1];
+static sf_block arena_free_lists[SF_MAX_ARENAS - 1][NUM_FREE_LISTS];
+static int arenas_created;
+static int next_arena;     // Round-robin cursor over arena indices
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread sf_heap *thread_arena; // Round-robin assignment, made on the thread's first call
+
+/*
+ * Per-thread cache of minimum-size-class blocks. Cached blocks stay marked allocated in the
+ * heap, so they never coalesce; each bin is a LIFO stack threaded through body.links.next,
+ * and body.links.prev holds the owning cache as a key to catch double frees.
+ */
+typedef struct sf_tcache
+{
+    sf_block *bins[TCACHE_BINS];
+    int counts[TCACHE_BINS];
+    unsigned long epoch;
+    int registered; // With tcache_key, so the thread's exit hands its blocks back
+    struct sf_tcache_stats stats;
+} sf_tcache;
+
+static __thread sf_tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+#ifdef SF_LATENCY
+/*
+ * Latency histograms, a slot per thread, claimed on the thread's first timed call and kept
+ * after it exits so merges still see its samples. Threads past the last slot share it and
+ * count with atomic adds; a slot of its own is only ever written by its thread.
+ */
+static struct sf_latency latency_slots[SF_LATENCY_THREADS];
+static int latency_claimed;
+static __thread struct sf_latency *latency_slot;
+#endif
+
+#ifdef SF_TRACE
+/*
+ * Trace recorder. trace_on gates recording; trace_lock serializes starting and stopping, and
+ * trace_fd, open only while a trace is, belongs to the flusher thread in between. A thread
+ * claims a free slot, and the ring mapped for it, on its first traced call; when it exits the
+ * slot is retired, and freed for the next thread once the flusher has drained its ring.
+ */
+static int trace_on;
+static int trace_fd = -1;
+static pthread_t trace_flusher;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static sf_trace_ring *trace_rings[SF_TRACE_THREADS];
+static int trace_slot_states[SF_TRACE_THREADS]; // SF_TRACE_SLOT_FREE, _OWNED or _RETIRED
+static uint32_t trace_slot_threads[SF_TRACE_THREADS]; // Number of the slot's latest owner
+static int trace_claimed;
+static uint64_t trace_slotless; // Events of calls made while every slot was taken
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static __thread int trace_slot; // One past the thread's ring index, 0 until it claims one
+#endif
+
+void *sf_malloc(size_t size)
+{
+    if (size <= 0)
+        return NULL;
+
+    if (mmap_threshold != 0 && size >= mmap_threshold)
+    {
+        void *pp = large_malloc(size);
+
+        if (pp != NULL)
+            return pp;
+    }
+
+    if (slab_enabled && size <= SLAB_MAX_OBJECT)
+    {
+        sf_heap *heap = thread_heap();
+
+        lock_heap(heap);
+        void *pp = slab_malloc(heap, size);
+        unlock_heap(heap);
+
+        return pp;
+    }
+
+    int rounded_size = round_to_64(size + sizeof(sf_header));
+
+    if (tcache_count != 0 && rounded_size <= TCACHE_MAX_BLOCK)
+        return tcache_malloc(rounded_size);
+
+    sf_heap *heap = thread_heap();
+
+    lock_heap(heap);
+    void *pp = malloc_block(heap, rounded_size);
+    unlock_heap(heap);
+
+    return pp;
+}
+
+void *malloc_block(sf_heap *heap, int rounded_size)
+{
+    sf_block *bp;
+
+    if ((heap_start(heap) == heap_end(heap)) && first_call_to_sf_malloc(heap) == -1)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    int found_empty_block = search_empty_block(heap, rounded_size, &bp); // The block comes back already unlinked
+
+    if (found_empty_block == -1)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    heap->class_stats[list_position(rounded_size)].mallocs++;
+
+    if (GET_BLOCK_SIZE(&bp->header) - rounded_size >= BLOCK_SZ) // Split the current block
+    {
+        if (found_empty_block >= NUM_FREE_LISTS - 1)
+            split_block(heap, bp, rounded_size, 1);
+        else
+            split_block(heap, bp, rounded_size, 0);
+    }
+    else
+    {
+        // A free block always follows an allocated one, so only the alloc bits change.
+        bp->header |= THIS_BLOCK_ALLOCATED;
+        (GET_NEXT_BLOCK(bp))->header |= PREV_BLOCK_ALLOCATED;
+    }
+
+    return bp->body.payload;
+}
+
+void sf_free(void *pp)
+{
+    sf_heap *heap = arena_of(pp); // Freed blocks always go back to the arena they came from
+    sf_slab *slab = slab_of(heap, pp);
+
+    if (slab != NULL)
+    {
+        lock_heap(heap);
+        slab_free(heap, slab, pp);
+        unlock_heap(heap);
+        return;
+    }
+
+    if (large_free(pp))
+        return;
+
+    // The cached path checks the pointer without the lock, so only against what the block's
+    // owner alone writes; valid_owned_pointer aborts rather than returning 0.
+    if (tcache_count != 0 && valid_owned_pointer(heap, pp) &&
+        GET_BLOCK_SIZE(&GET_BLOCK_FROM_PAYLOAD(pp)->header) <= TCACHE_MAX_BLOCK)
+    {
+        tcache_free(GET_BLOCK_FROM_PAYLOAD(pp));
+        return;
+    }
+
+    lock_heap(heap);
+
+    if (!valid_pointer(heap, pp))
+        abort();
+
+    free_block(heap, GET_BLOCK_FROM_PAYLOAD(pp));
+    unlock_heap(heap);
+}
+
+void sf_free_sized(void *pp, size_t size)
+{
+    // Slab objects have no header of their own, so the row in front of one is another object.
+    // Slabs made before SF_OPT_SLAB was turned off still hold theirs.
+    if (size <= SLAB_MAX_OBJECT && (slab_enabled || slab_of(arena_of(pp), pp) != NULL))
+    {
+        sf_free(pp);
+        return;
+    }
+
+    sf_block *bp = GET_BLOCK_FROM_PAYLOAD(pp);
+    sf_header expected = round_to_64(size + sizeof(sf_header)) | THIS_BLOCK_ALLOCATED;
+
+    // One compare stands in for the validation walk; anything that disagrees takes the long
+    // way, including large objects, whose header row is never written
+    if (pp == NULL || (uintptr_t)pp % BLOCK_SZ != 0 || (bp->header & ~PREV_BLOCK_ALLOCATED) != expected)
+    {
+        sf_free(pp);
+        return;
+    }
+
+    if (tcache_count != 0 && GET_BLOCK_SIZE(&bp->header) <= TCACHE_MAX_BLOCK)
+    {
+        tcache_free(bp);
+        return;
+    }
+
+    sf_heap *heap = arena_of(pp);
+
+    lock_heap(heap);
+    free_block(heap, bp);
+    unlock_heap(heap);
+}
+
+size_t sf_malloc_usable_size(void *pp)
+{
+    if (pp == NULL)
+        return 0;
+
+    sf_heap *heap = arena_of(pp);
+    sf_slab *slab = slab_of(heap, pp);
+
+    if (slab != NULL)
+        return slab->object_size;
+
+    if (is_large(pp))
+    {
+        lock_large();
+        sf_large *entry = large_find(large_base(pp));
+        size_t usable = entry->length - (pp - entry->base);
+        unlock_large();
+
+        return usable;
+    }
+
+    // No lock, so nothing the neighbours' frees rewrite is read; the size bits are the owner's
+    if (!valid_owned_pointer(heap, pp))
+        abort();
+
+    sf_header header = __atomic_load_n(&GET_BLOCK_FROM_PAYLOAD(pp)->header, __ATOMIC_RELAXED);
+
+    return GET_BLOCK_SIZE(&header) - sizeof(sf_header);
+}
+
+int sf_owns(void *pp)
+{
+    if (pp >= sf_mem_start() && pp < sf_mem_end())
+        return 1;
+
+    int created = __atomic_load_n(&arenas_created, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < created; i++)
+    {
+        if (pp >= arenas[i].mem_start && pp < arenas[i].mem_limit)
+            return 1;
+    }
+
+    return is_large(pp);
+}
+
+void free_block(sf_heap *heap, sf_block *bp)
+{
+    heap->class_stats[list_position(GET_BLOCK_SIZE(&bp->header))].frees++;
+    release_block(heap, bp);
+}
+
+/*
+ * The work of free_block without counting a free, for the remainders that splits hand back.
+ */
+void release_block(sf_heap *heap, sf_block *bp)
+{
+    sf_block *next_block = GET_NEXT_BLOCK(bp);
+    int merges = 0;
+
+    bp->header &= ~THIS_BLOCK_ALLOCATED; // Free the block
+
+    // Next is free: it is either the wilderness or sits in one of the size-class lists
+    if (!IS_ALLOC(&next_block->header))
+    {
+        if (!remove_block(heap, next_block))
+            debug("ERROR IN !NEXT");
+
+        bp = coalesce(bp, next_block);
+        merges++;
+    }
+
+    // Prev is free: the prev_alloc bit says so and prev_footer holds its size
+    if (!IS_PREV_ALLOC(&bp->header))
+    {
+        sf_block *prev_block = GET_PREV_BLOCK(bp);
+
+        if (!remove_block(heap, prev_block))
+            debug("ERROR IN !PREV");
+
+        bp = coalesce(prev_block, bp);
+        merges++;
+    }
+
+    next_block = GET_NEXT_BLOCK(bp);
+    next_block->prev_footer = bp->header;
+    next_block->header &= ~PREV_BLOCK_ALLOCATED;
+
+    if (merges != 0)
+        heap->class_stats[next_block == heap->epilogue ? NUM_FREE_LISTS - 1 : list_position(GET_BLOCK_SIZE(&bp->header))].coalesces += merges;
+
+    if (next_block == heap->epilogue) // Anything that reaches the epilogue is the wilderness
+    {
+        add_block_to_list(heap, bp, 1);
+
+        if (trim_threshold != 0 && GET_BLOCK_SIZE(&bp->header) > trim_threshold)
+            trim_wilderness(heap, 0);
+    }
+    else
+        add_block_to_list(heap, bp, 0);
+
+    if (purge_decay_ms > 0 && ++heap->purge_ticks >= SF_PURGE_TICKS)
+    {
+        heap->purge_ticks = 0;
+        purge_free_blocks(heap, purge_clock_ms() - purge_decay_ms);
+    }
+}
+
+void *sf_realloc(void *pp, size_t rsize)
+{
+    sf_heap *heap = arena_of(pp);
+    sf_slab *slab = slab_of(heap, pp);
+
+    if (slab != NULL) // Slab objects have no header to resize, so they only ever move
+    {
+        if (rsize != 0 && rsize <= slab->object_size)
+            return pp;
+
+        void *new_pp = NULL;
+
+        if (rsize != 0 && (new_pp = sf_malloc(rsize)) == NULL)
+            return NULL;
+
+        if (new_pp != NULL)
+            memcpy(new_pp, pp, slab->object_size);
+
+        sf_free(pp);
+        return new_pp;
+    }
+
+    if (is_large(pp))
+    {
+        if (rsize == 0)
+        {
+            large_free(pp);
+            return NULL;
+        }
+
+        return large_realloc(pp, rsize);
+    }
+
+    lock_heap(heap);
+
+    if (valid_pointer(heap, pp))
+    {
+        if (rsize == 0)
+        {
+            free_block(heap, GET_BLOCK_FROM_PAYLOAD(pp));
+            unlock_heap(heap);
+            return NULL;
+        }
+    }
+    else
+        abort();
+
+    sf_block *pp_block = GET_BLOCK_FROM_PAYLOAD(pp);
+    int rounded_rsize = round_to_64(rsize + sizeof(sf_header));
+
+    sf_block *resized;
+    void *new_pp = NULL;
+
+    size_t old_usable = GET_BLOCK_SIZE(&pp_block->header) - sizeof(sf_header);
+
+    // Past the threshold a growing block moves out to a mapping of its own; a shrinking one
+    // splits in place, which is cheaper than a mapping and never larger
+    if (mmap_threshold != 0 && rsize >= mmap_threshold && rsize > old_usable)
+        new_pp = large_malloc(rsize);
+
+    if (new_pp == NULL && (resized = resize_in_place(heap, pp_block, rounded_rsize, realloc_wilderness, 1)) != NULL)
+    {
+        unlock_heap(heap);
+        return resized->body.payload;
+    }
+
+    // Neither neighbour has room, so move the payload to a new block
+    if (new_pp == NULL)
+        new_pp = malloc_block(heap, rounded_rsize);
+
+    if (new_pp == NULL)
+    {
+        unlock_heap(heap);
+        return NULL;
+    }
+
+    memcpy(new_pp, pp, old_usable < rsize ? old_usable : rsize);
+    free_block(heap, pp_block);
+    unlock_heap(heap);
+
+    return new_pp;
+}
+
+size_t sf_realloc_in_place(void *pp, size_t rsize)
+{
+    sf_heap *heap = arena_of(pp);
+    sf_slab *slab = slab_of(heap, pp);
+
+    if (slab != NULL)
+        return slab->object_size;
+
+    if (is_large(pp))
+        return large_realloc_in_place(pp, rsize);
+
+    lock_heap(heap);
+
+    if (!valid_pointer(heap, pp))
+        abort();
+
+    sf_block *pp_block = GET_BLOCK_FROM_PAYLOAD(pp);
+
+    if (rsize != 0)
+        resize_in_place(heap, pp_block, round_to_64(rsize + sizeof(sf_header)), 1, 0);
+
+    size_t usable = GET_BLOCK_SIZE(&pp_block->header) - sizeof(sf_header);
+    unlock_heap(heap);
+
+    return usable;
+}
+
+sf_block *resize_in_place(sf_heap *heap, sf_block *bp, int rounded_size, int use_wilderness, int move_back)
+{
+    int size = GET_BLOCK_SIZE(&bp->header);
+
+    if (size >= rounded_size)
+    {
+        shrink_block(heap, bp, rounded_size);
+        return bp;
+    }
+
+    sf_block *next_block = GET_NEXT_BLOCK(bp);
+    int next_free = !IS_ALLOC(&next_block->header) ? GET_BLOCK_SIZE(&next_block->header) : 0;
+    int at_top = next_block == heap->epilogue || (next_free && GET_NEXT_BLOCK(next_block) == heap->epilogue);
+
+    if (at_top && !use_wilderness)
+        next_free = 0;
+
+    // Forward into a free successor, or into a wilderness grown as far as it takes
+    if (size + next_free >= rounded_size || (at_top && use_wilderness))
+    {
+        sf_block *absorbed = next_block;
+
+        int old_errno = sf_errno;
+
+        if (size + next_free >= rounded_size)
+            remove_block(heap, next_block);
+        else if ((absorbed = take_wilderness(heap, rounded_size - size)) == NULL)
+        {
+            sf_errno = old_errno; // Running out of room here is not an error; the caller decides what to do
+            return NULL;
+        }
+
+        bp->header += GET_BLOCK_SIZE(&absorbed->header);
+        (GET_NEXT_BLOCK(bp))->header |= PREV_BLOCK_ALLOCATED;
+
+        shrink_block(heap, bp, rounded_size);
+
+        // An absorbed wilderness is handed out without take_wilderness, which would have moved this
+        if ((void *)GET_NEXT_BLOCK(bp) + WILDERNESS_TAGS_SZ > heap->zero_from)
+            heap->zero_from = (void *)GET_NEXT_BLOCK(bp) + WILDERNESS_TAGS_SZ;
+
+        return bp;
+    }
+
+    // Backward into a free predecessor, taking a free successor along, then slide the payload down
+    if (move_back && !IS_PREV_ALLOC(&bp->header))
+    {
+        sf_block *prev_block = GET_PREV_BLOCK(bp);
+        int prev_size = GET_BLOCK_SIZE(&prev_block->header);
+
+        if (prev_size + size + next_free < rounded_size)
+            return NULL;
+
+        remove_block(heap, prev_block);
+        if (next_free)
+            remove_block(heap, next_block);
+
+        prev_block->header = (prev_size + size + next_free) | GET_PREV_ALLOC(&prev_block->header) | THIS_BLOCK_ALLOCATED;
+        (GET_NEXT_BLOCK(prev_block))->header |= PREV_BLOCK_ALLOCATED;
+        memmove(prev_block->body.payload, bp->body.payload, size - sizeof(sf_header));
+
+        shrink_block(heap, prev_block, rounded_size);
+        return prev_block;
+    }
+
+    return NULL;
+}
+
+void *sf_memalign(size_t size, size_t align)
+{
+    if (align < BLOCK_SZ || !is_power_of_2(align))
+    {
+        sf_errno = EINVAL;
+        return NULL;
+    }
+
+    if (size == 0)
+        return NULL;
+
+    // An alignment past a page would strand most of a page in front of the block; a mapping
+    // of its own slides into place instead
+    if (align > PAGE_SZ || (mmap_threshold != 0 && size >= mmap_threshold))
+    {
+        void *pp = large_memalign(size, align);
+
+        if (pp != NULL)
+            return pp;
+    }
+
+    sf_heap *heap = thread_heap();
+
+    lock_heap(heap);
+    void *pp = malloc_aligned_block(heap, round_to_64(size + sizeof(sf_header)), align);
+    unlock_heap(heap);
+
+    return pp;
+}
+
+int sf_mallopt(int param, int value)
+{
+    switch (param)
+    {
+    case SF_OPT_TCACHE_COUNT:
+        if (value < 0 || value > SF_TCACHE_MAX_COUNT)
+            return 0;
+        tcache_count = value;
+        sf_tcache_flush(); // Drop anything above the new bound (or everything, if caching is now off)
+        return 1;
+    case SF_OPT_MULTITHREADED:
+        if (value != 0 && value != 1)
+            return 0;
+        heap_locking = value;
+        return 1;
+    case SF_OPT_ARENA_COUNT:
+        if (value < 1 || value > SF_MAX_ARENAS)
+            return 0;
+        arena_count = value;
+        return 1;
+    case SF_OPT_REALLOC_WILDERNESS:
+        if (value != 0 && value != 1)
+            return 0;
+        realloc_wilderness = value;
+        return 1;
+    case SF_OPT_MMAP_THRESHOLD:
+        if (value < 0)
+            return 0;
+        mmap_threshold = value;
+        return 1;
+    case SF_OPT_GROWTH_POLICY:
+        if (value != SF_GROWTH_EXACT && value != SF_GROWTH_GEOMETRIC)
+            return 0;
+        growth_policy = value;
+        return 1;
+    case SF_OPT_TRIM_THRESHOLD:
+        if (value < 0)
+            return 0;
+        trim_threshold = value;
+        return 1;
+    case SF_OPT_FIT_POLICY:
+        if (value < SF_FIT_FIRST || value > SF_FIT_GOOD)
+            return 0;
+        fit_policy = value;
+        return 1;
+    case SF_OPT_FIT_CANDIDATES:
+        if (value < 1)
+            return 0;
+        fit_candidates = value;
+        return 1;
+    case SF_OPT_PURGE_DECAY:
+        if (value < -1)
+            return 0;
+        purge_decay_ms = value;
+        return 1;
+    case SF_OPT_SLAB:
+        if (value != 0 && value != 1)
+            return 0;
+        slab_enabled = value;
+        return 1;
+    case SF_OPT_ARENA_POLICY:
+        if (value != SF_ARENA_ROUND_ROBIN && value != SF_ARENA_BY_CPU)
+            return 0;
+        arena_policy = value;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void sf_tcache_stats(struct sf_tcache_stats *stats)
+{
+    *stats = tcache.stats;
+}
+
+void sf_tcache_flush()
+{
+    tcache_check_epoch();
+
+    for (int bin = 0; bin < TCACHE_BINS; bin++)
+        tcache_flush_bin(bin, tcache.counts[bin] - tcache_count);
+}
+
+void sf_get_stats(struct sf_stats *stats)
+{
+    size_t largest = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    int created = __atomic_load_n(&arenas_created, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i <= created; i++)
+    {
+        sf_heap *heap = i == 0 ? &main_heap : &arenas[i - 1];
+
+        lock_heap(heap);
+
+        if (heap_start(heap) != heap_end(heap))
+        {
+            size_t heap_bytes = heap_end(heap) - heap_start(heap);
+            size_t free_bytes = 0;
+
+            for (int c = 0; c < NUM_FREE_LISTS; c++)
+            {
+                struct sf_class_stats *class = &stats->classes[c];
+                sf_block *list = &heap->free_lists[c];
+
+                class->mallocs += heap->class_stats[c].mallocs;
+                class->frees += heap->class_stats[c].frees;
+                class->splits += heap->class_stats[c].splits;
+                class->coalesces += heap->class_stats[c].coalesces;
+
+                for (sf_block *bp = list->body.links.next; bp != list; bp = bp->body.links.next)
+                {
+                    size_t size = GET_BLOCK_SIZE(&bp->header);
+
+                    class->free_blocks++;
+                    class->free_bytes += size;
+                    free_bytes += size;
+                    if (size > largest)
+                        largest = size;
+                }
+            }
+
+            stats->heap_bytes += heap_bytes;
+            stats->free_bytes += free_bytes;
+            stats->live_bytes += heap_bytes - HEAP_TAGS_SZ - free_bytes;
+            stats->peak_heap_bytes += heap->peak_heap;
+            stats->grow_calls += heap->grow_calls;
+        }
+
+        unlock_heap(heap);
+    }
+
+    lock_large();
+    stats->large_bytes = large_bytes;
+    stats->large_mallocs = large_mallocs;
+    stats->large_frees = large_frees;
+    unlock_large();
+
+    stats->total_bytes = stats->heap_bytes + stats->large_bytes;
+    stats->live_bytes += stats->large_bytes;
+    stats->fragmentation = stats->free_bytes == 0 ? 0.0 : 1.0 - (double)largest / stats->free_bytes;
+}
+
+int sf_malloc_trim(size_t pad)
+{
+    size_t released = 0;
+
+    // Cached blocks and empty slabs hold on to heap memory that could otherwise coalesce into the wilderness
+    tcache_check_epoch();
+    for (int bin = 0; bin < TCACHE_BINS; bin++)
+        tcache_flush_bin(bin, tcache.counts[bin]);
+
+    int created = __atomic_load_n(&arenas_created, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i <= created; i++)
+    {
+        sf_heap *heap = i == 0 ? &main_heap : &arenas[i - 1];
+
+        lock_heap(heap);
+
+        if (heap_start(heap) != heap_end(heap))
+        {
+            release_empty_slabs(heap);
+            released += purge_free_blocks(heap, UINT64_MAX);
+            released += trim_wilderness(heap, pad);
+        }
+
+        unlock_heap(heap);
+    }
+
+    return released != 0;
+}
+
+void *sf_calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+
+    if (__builtin_mul_overflow(nmemb, size, &total))
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    if (total == 0)
+        return NULL;
+
+    if (mmap_threshold != 0 && total >= mmap_threshold)
+    {
+        void *pp = large_malloc(total); // A fresh mapping is already zero
+
+        if (pp != NULL)
+            return pp;
+    }
+
+    int rounded_size = round_to_64(total + sizeof(sf_header));
+
+    if ((slab_enabled && total <= SLAB_MAX_OBJECT) || (tcache_count != 0 && rounded_size <= TCACHE_MAX_BLOCK))
+    {
+        void *pp = sf_malloc(total); // A row or three: not worth tracking
+
+        if (pp != NULL)
+            memset(pp, 0, total);
+        return pp;
+    }
+
+    sf_heap *heap = thread_heap();
+
+    lock_heap(heap);
+
+    // Lay the heap out first so zero_from is not left over from before the last sf_mem_init
+    if ((heap_start(heap) == heap_end(heap)) && first_call_to_sf_malloc(heap) == -1)
+    {
+        unlock_heap(heap);
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    void *zero_from = heap->zero_from; // Read before the block is carved, which moves it
+    void *end = heap_end(heap);
+    void *pp = malloc_block(heap, rounded_size);
+
+    if (heap == &main_heap && heap_end(heap) != end) // sfutil pages are recycled, so growth brings in dirty memory
+        zero_from = heap_end(heap);
+
+    // Only what lies below zero_from was ever handed out or tagged, bar the epilogue's
+    // prev_footer, which is the last row of a block carved right up to the epilogue
+    int at_top = pp != NULL && GET_NEXT_BLOCK(GET_BLOCK_FROM_PAYLOAD(pp)) == heap->epilogue;
+
+    unlock_heap(heap);
+
+    if (pp == NULL)
+        return NULL;
+
+    size_t usable = GET_BLOCK_SIZE(&GET_BLOCK_FROM_PAYLOAD(pp)->header) - sizeof(sf_header);
+    size_t dirty = zero_from > pp ? (size_t)(zero_from - pp) : 0;
+
+    if (dirty >= usable - sizeof(sf_footer))
+        dirty = usable;
+    else if (at_top)
+        memset(pp + usable - sizeof(sf_footer), 0, sizeof(sf_footer));
+
+    memset(pp, 0, dirty); // glibc picks the widest vector stores the CPU has
+    return pp;
+}
+
+size_t sf_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t done = 0;
+
+    if (size <= 0)
+        return 0;
+
+    if (mmap_threshold != 0 && size >= mmap_threshold) // Every large object is a mapping of its own
+    {
+        while (done < n && (out[done] = sf_malloc(size)) != NULL)
+            done++;
+        return done;
+    }
+
+    sf_heap *heap = thread_heap();
+
+    lock_heap(heap);
+
+    if (slab_enabled && size <= SLAB_MAX_OBJECT)
+    {
+        while (done < n && (out[done] = slab_malloc(heap, size)) != NULL)
+            done++;
+        unlock_heap(heap);
+        return done;
+    }
+
+    int rounded_size = round_to_64(size + sizeof(sf_header));
+    size_t chunk = n;
+    int old_errno = sf_errno;
+
+    // Try for one region that holds every block; halve the ask while the heap cannot supply it
+    while (done < n)
+    {
+        size_t carved = carve_blocks(heap, rounded_size, chunk < n - done ? chunk : n - done, out + done);
+
+        if (carved == 0)
+        {
+            if (chunk == 1)
+                break;
+            chunk /= 2;
+            sf_errno = old_errno;
+        }
+        done += carved;
+    }
+
+    unlock_heap(heap);
+    return done;
+}
+
+/*
+ * Takes one free region big enough for n blocks of rounded_size and lays them out back to
+ * back, allocated. A remainder of a whole row or more goes back to the free lists, anything
+ * less is absorbed by the last block, just as malloc_block does for a single block.
+ */
+size_t carve_blocks(sf_heap *heap, int rounded_size, size_t n, void **out)
+{
+    sf_block *bp;
+
+    if ((heap_start(heap) == heap_end(heap)) && first_call_to_sf_malloc(heap) == -1)
+    {
+        sf_errno = ENOMEM;
+        return 0;
+    }
+
+    if (n > SIZE_MAX / rounded_size)
+        n = SIZE_MAX / rounded_size;
+
+    int position = search_empty_block(heap, n * rounded_size, &bp); // The region comes back unlinked
+
+    if (position == -1)
+    {
+        sf_errno = ENOMEM;
+        return 0;
+    }
+
+    size_t remainder = GET_BLOCK_SIZE(&bp->header) - n * rounded_size;
+    sf_header prev_alloc = GET_PREV_ALLOC(&bp->header);
+
+    heap->class_stats[list_position(rounded_size)].mallocs += n;
+    if (remainder >= BLOCK_SZ)
+        heap->class_stats[position].splits++;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t block_size = i == n - 1 && remainder < BLOCK_SZ ? rounded_size + remainder : rounded_size;
+
+        bp->header = block_size | prev_alloc | THIS_BLOCK_ALLOCATED;
+        out[i] = bp->body.payload;
+        bp = GET_NEXT_BLOCK(bp);
+        prev_alloc = PREV_BLOCK_ALLOCATED;
+    }
+
+    if (remainder >= BLOCK_SZ)
+    {
+        bp->header = remainder | PREV_BLOCK_ALLOCATED;
+        (GET_NEXT_BLOCK(bp))->prev_footer = bp->header;
+        add_block_to_list(heap, bp, position == NUM_FREE_LISTS - 1);
+    }
+    else
+        bp->header |= PREV_BLOCK_ALLOCATED; // bp is the block after the region
+
+    return n;
+}
+
+void sf_free_batch(void **ptrs, size_t n)
+{
+    sf_heap *locked = NULL; // Runs of blocks from the same arena share one trip through its lock
+
+    sort_addresses(ptrs, n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        sf_heap *heap = arena_of(ptrs[i]);
+
+        if (slab_of(heap, ptrs[i]) != NULL || is_large(ptrs[i])) // Not heap blocks, so sf_free sorts them out
+        {
+            if (locked != NULL)
+                unlock_heap(locked);
+            locked = NULL;
+            sf_free(ptrs[i]);
+            continue;
+        }
+
+        if (heap != locked)
+        {
+            if (locked != NULL)
+                unlock_heap(locked);
+            lock_heap(heap);
+            locked = heap;
+        }
+
+        if (!valid_pointer(heap, ptrs[i]))
+            abort();
+
+        // Sorted, a run of neighbouring blocks is a run of the array: fold it into one block
+        // so it is unlinked, coalesced and listed once
+        sf_block *bp = GET_BLOCK_FROM_PAYLOAD(ptrs[i]);
+        heap->class_stats[list_position(GET_BLOCK_SIZE(&bp->header))].frees++;
+
+        while (i + 1 < n && ptrs[i + 1] == (GET_NEXT_BLOCK(bp))->body.payload && valid_pointer(heap, ptrs[i + 1]))
+        {
+            heap->class_stats[list_position(GET_BLOCK_SIZE(&(GET_NEXT_BLOCK(bp))->header))].frees++;
+            bp->header += GET_BLOCK_SIZE(&(GET_NEXT_BLOCK(bp))->header);
+            heap->class_stats[list_position(GET_BLOCK_SIZE(&bp->header))].coalesces++;
+            i++;
+        }
+
+        release_block(heap, bp);
+    }
+
+    if (locked != NULL)
+        unlock_heap(locked);
+}
+
+/*
+ * Sorts the pointers by address without qsort, whose comparator calls and scratch memory
+ * (taken from the system allocator) cost more than the frees they order. Short batches use
+ * insertion sort, mid-sized ones a radix sort, and anything left a heapsort in place.
+ */
+void sort_addresses(void **ptrs, size_t n)
+{
+    size_t sorted = 1;
+
+    while (sorted < n && (uintptr_t)ptrs[sorted - 1] <= (uintptr_t)ptrs[sorted]) // Batches often arrive in order
+        sorted++;
+    if (sorted >= n)
+        return;
+
+    if (n <= SF_INSERTION_MAX) // The tail of a short batch is cheapest to insert one by one
+    {
+        for (; sorted < n; sorted++)
+        {
+            void *moving = ptrs[sorted];
+            size_t i = sorted;
+
+            for (; i > 0 && (uintptr_t)ptrs[i - 1] > (uintptr_t)moving; i--)
+                ptrs[i] = ptrs[i - 1];
+            ptrs[i] = moving;
+        }
+        return;
+    }
+
+    if (n <= SF_RADIX_MAX && radix_sort_addresses(ptrs, n))
+        return;
+
+    for (size_t i = n / 2; i > 0; i--)
+        sift_address(ptrs, i - 1, n);
+
+    for (size_t end = n; end > 1; end--)
+    {
+        void *top = ptrs[0];
+        ptrs[0] = ptrs[end - 1];
+        ptrs[end - 1] = top;
+        sift_address(ptrs, 0, end - 1);
+    }
+}
+
+/*
+ * Two-pass radix sort on the row offset from the lowest pointer, for batches whose pointers
+ * span fewer than 65536 rows (4 MiB); returns 0, leaving ptrs alone, for wider ones.
+ */
+int radix_sort_addresses(void **ptrs, size_t n)
+{
+    void *scratch[SF_RADIX_MAX];
+    uintptr_t low = UINTPTR_MAX, high = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        low = (uintptr_t)ptrs[i] < low ? (uintptr_t)ptrs[i] : low;
+        high = (uintptr_t)ptrs[i] > high ? (uintptr_t)ptrs[i] : high;
+    }
+
+    if ((high - low) / BLOCK_SZ >= 65536)
+        return 0;
+
+    void **from = ptrs, **to = scratch;
+
+    for (int shift = 0; shift < 16; shift += 8)
+    {
+        size_t offsets[256] = {0};
+
+        for (size_t i = 0; i < n; i++)
+            offsets[((uintptr_t)from[i] - low) / BLOCK_SZ >> shift & 0xff]++;
+        for (size_t digit = 0, total = 0; digit < 256; digit++)
+        {
+            size_t count = offsets[digit];
+            offsets[digit] = total;
+            total += count;
+        }
+        for (size_t i = 0; i < n; i++)
+            to[offsets[((uintptr_t)from[i] - low) / BLOCK_SZ >> shift & 0xff]++] = from[i];
+
+        void **swap = from;
+        from = to;
+        to = swap;
+    }
+
+    return 1; // Two passes leave the result back in ptrs
+}
+
+void sift_address(void **ptrs, size_t root, size_t n)
+{
+    void *moving = ptrs[root];
+
+    for (size_t child; (child = 2 * root + 1) < n; root = child)
+    {
+        if (child + 1 < n && (uintptr_t)ptrs[child + 1] > (uintptr_t)ptrs[child])
+            child++;
+        if ((uintptr_t)ptrs[child] <= (uintptr_t)moving)
+            break;
+        ptrs[root] = ptrs[child];
+    }
+
+    ptrs[root] = moving;
+}
+
+/*
+ * Hands back the pages at the top of the wilderness, keeping pad bytes of it resident. An
+ * arena shrinks its end for real. sfutil cannot shrink, so the sfutil heap keeps its
+ * wilderness and epilogue where they are and only madvises the page-aligned stretch between
+ * the wilderness links and the epilogue; the kernel refills it with zeros on the next touch.
+ */
+size_t trim_wilderness(sf_heap *heap, size_t pad)
+{
+    if (!(heap->free_list_bitmap & (1U << (NUM_FREE_LISTS - 1))))
+        return 0;
+
+    sf_block *wilderness = heap->free_lists[NUM_FREE_LISTS - 1].body.links.next;
+    size_t size = GET_BLOCK_SIZE(&wilderness->header);
+
+    if (heap != &main_heap)
+    {
+        if (size < pad + BLOCK_SZ + PAGE_SZ)
+            return 0;
+
+        size_t trimmed = (size - pad - BLOCK_SZ) / PAGE_SZ * PAGE_SZ;
+
+        remove_block(heap, wilderness);
+        wilderness->header -= trimmed;
+        heap->mem_end -= trimmed;
+        madvise(heap->mem_end, trimmed, MADV_DONTNEED);
+        if (heap->zero_from > heap->mem_end)
+            heap->zero_from = heap->mem_end;
+
+        add_epilogue(heap, wilderness);
+        add_block_to_list(heap, wilderness, 1);
+        return trimmed;
+    }
+
+    uintptr_t start = round_to_page((uintptr_t)wilderness->body.payload + 2 * sizeof(sf_block *) + pad);
+    uintptr_t end = heap->released != NULL ? (uintptr_t)heap->released : (uintptr_t)heap->epilogue & ~(uintptr_t)(PAGE_SZ - 1);
+
+    if (start >= end)
+        return 0;
+
+    madvise((void *)start, end - start, MADV_DONTNEED);
+
+    // Clearing the few bytes under the epilogue makes one zero stretch from start upwards
+    if (heap->released == NULL)
+    {
+        memset((void *)end, 0, (uintptr_t)heap->epilogue - end);
+        heap->zero_from = (void *)start;
+    }
+    else if (heap->zero_from <= heap->released)
+        heap->zero_from = (void *)start;
+
+    heap->released = (void *)start;
+
+    return end - start;
+}
+
+void release_empty_slabs(sf_heap *heap)
+{
+    for (int slab_class = 0; slab_class < SLAB_CLASSES; slab_class++)
+    {
+        sf_slab *slab = heap->slabs[slab_class];
+
+        // slab_free keeps at most one empty slab per class, and only when it is the class's last
+        if (slab != NULL && slab->free_count == slab->capacity && slab->next == NULL)
+        {
+            unlink_slab(heap, slab);
+            set_slab_page(heap, slab, 0);
+            free_block(heap, GET_BLOCK_FROM_PAYLOAD(slab));
+        }
+    }
+}
+
+/*
+ * Hands back the page-aligned interior of a free block in the last size class. The header,
+ * links, stamp and the next block's prev_footer all sit outside the advised range, so the
+ * block stays on its list untouched and whoever allocates it next just sees zeroed pages.
+ */
+size_t purge_block(sf_block *bp)
+{
+    uintptr_t start = round_to_page((uintptr_t)&PURGE_STAMP(bp) + sizeof(uint64_t));
+    uintptr_t end = (uintptr_t)GET_NEXT_BLOCK(bp) & ~(uintptr_t)(PAGE_SZ - 1);
+
+    PURGE_STAMP(bp) = 0;
+
+    if (start >= end)
+        return 0;
+
+    madvise((void *)start, end - start, MADV_DONTNEED);
+    return end - start;
+}
+
+/*
+ * Purges every last-class block that went free at or before freed_before and has not been
+ * purged since. A block freshly merged with a purged neighbour carries a new stamp, so the
+ * resident part of it is caught on a later pass.
+ */
+size_t purge_free_blocks(sf_heap *heap, uint64_t freed_before)
+{
+    sf_block *head = &heap->free_lists[NUM_FREE_LISTS - 2];
+    size_t purged = 0;
+
+    for (sf_block *bp = head->body.links.next; bp != head; bp = bp->body.links.next)
+        if (PURGE_STAMP(bp) != 0 && PURGE_STAMP(bp) <= freed_before)
+            purged += purge_block(bp);
+
+    return purged;
+}
+
+uint64_t purge_clock_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + 1; // Never 0, which means purged
+}
+
+void lock_heap(sf_heap *heap)
+{
+    if (heap_locking)
+        pthread_mutex_lock(&heap->lock);
+}
+
+void unlock_heap(sf_heap *heap)
+{
+    if (heap_locking)
+        pthread_mutex_unlock(&heap->lock);
+}
+
+/*
+ * Slabs are one-page blocks taken from the heap with their payload on a page boundary. The
+ * slab header sits at the start of the payload, so any object pointer masks down to it, and
+ * the heap's slab_pages bitmap tells a slab page apart from ordinary blocks.
+ */
+void *slab_malloc(sf_heap *heap, size_t size)
+{
+    int slab_class = (size + SLAB_GRANULE - 1) / SLAB_GRANULE - 1;
+    sf_slab *slab = heap->slabs[slab_class];
+
+    if (slab == NULL)
+    {
+        if ((slab = new_slab(heap, (slab_class + 1) * SLAB_GRANULE)) == NULL)
+            return NULL;
+
+        heap->slabs[slab_class] = slab;
+    }
+
+    int word = 0;
+    while (slab->free_map[word] == 0)
+        word++;
+
+    int index = word * 64 + __builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= ~(1ULL << (index % 64));
+
+    if (--slab->free_count == 0) // A full slab leaves the partial list until something is freed
+        unlink_slab(heap, slab);
+
+    return (void *)slab + SLAB_HEADER_SZ + index * slab->object_size;
+}
+
+void slab_free(sf_heap *heap, sf_slab *slab, void *pp)
+{
+    size_t offset = pp - ((void *)slab + SLAB_HEADER_SZ);
+    int index = offset / slab->object_size;
+
+    if (pp < (void *)slab + SLAB_HEADER_SZ || offset % slab->object_size != 0 || index >= slab->capacity)
+        abort(); // Not the start of an object in this slab
+
+    if (slab->free_map[index / 64] & (1ULL << (index % 64)))
+        abort(); // Double free
+
+    slab->free_map[index / 64] |= 1ULL << (index % 64);
+
+    if (slab->free_count++ == 0) // Was full, so it is usable again
+    {
+        int slab_class = slab->object_size / SLAB_GRANULE - 1;
+
+        slab->prev = NULL;
+        slab->next = heap->slabs[slab_class];
+        if (slab->next != NULL)
+            slab->next->prev = slab;
+        heap->slabs[slab_class] = slab;
+    }
+
+    // Hand an empty slab back to the heap, unless it is the only one its class has left
+    if (slab->free_count == slab->capacity && (slab->next != NULL || slab->prev != NULL))
+    {
+        unlink_slab(heap, slab);
+        set_slab_page(heap, slab, 0);
+        free_block(heap, GET_BLOCK_FROM_PAYLOAD(slab));
+    }
+}
+
+sf_slab *new_slab(sf_heap *heap, int object_size)
+{
+    void *pp = malloc_aligned_block(heap, PAGE_SZ, PAGE_SZ);
+
+    if (pp == NULL)
+        return NULL;
+
+    sf_slab *slab = pp;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->object_size = object_size;
+    slab->capacity = (PAGE_SZ - sizeof(sf_header) - SLAB_HEADER_SZ) / object_size;
+    slab->free_count = slab->capacity;
+
+    memset(slab->free_map, 0, sizeof(slab->free_map));
+    for (int i = 0; i < slab->capacity; i++)
+        slab->free_map[i / 64] |= 1ULL << (i % 64);
+
+    set_slab_page(heap, slab, 1);
+    return slab;
+}
+
+void unlink_slab(sf_heap *heap, sf_slab *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        heap->slabs[slab->object_size / SLAB_GRANULE - 1] = slab->next;
+
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+sf_slab *slab_of(sf_heap *heap, void *pp)
+{
+    uintptr_t first_page = (uintptr_t)heap_start(heap) & ~(uintptr_t)(PAGE_SZ - 1);
+    uintptr_t page = ((uintptr_t)pp - first_page) / PAGE_SZ; // Pointers below the heap wrap around and fail the bound
+
+    if (page >= SLAB_MAP_PAGES || !(heap->slab_pages[page / 8] & (1 << (page % 8))))
+        return NULL;
+
+    return (sf_slab *)((uintptr_t)pp & ~(uintptr_t)(PAGE_SZ - 1));
+}
+
+void set_slab_page(sf_heap *heap, sf_slab *slab, int is_slab)
+{
+    uintptr_t first_page = (uintptr_t)heap_start(heap) & ~(uintptr_t)(PAGE_SZ - 1);
+    uintptr_t page = ((uintptr_t)slab - first_page) / PAGE_SZ;
+
+    if (is_slab)
+        heap->slab_pages[page / 8] |= 1 << (page % 8);
+    else
+        heap->slab_pages[page / 8] &= ~(1 << (page % 8));
+}
+
+void init_slabs(sf_heap *heap)
+{
+    memset(heap->slabs, 0, sizeof(heap->slabs));
+    memset(heap->slab_pages, 0, sizeof(heap->slab_pages));
+}
+
+/*
+ * Carves a block of rounded_size whose payload is a multiple of align out of the first free
+ * block that has such a position in it, or out of the wilderness. Payloads are 64-aligned, so
+ * the gap in front of the aligned payload is either 0 or a whole free block of its own.
+ */
+void *malloc_aligned_block(sf_heap *heap, int rounded_size, size_t align)
+{
+    sf_block *bp;
+    size_t lead;
+
+    if ((heap_start(heap) == heap_end(heap)) && first_call_to_sf_malloc(heap) == -1)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    int position = search_aligned_block(heap, rounded_size, align, &bp, &lead); // Comes back unlinked
+
+    if (position == -1)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    heap->class_stats[list_position(rounded_size)].mallocs++;
+
+    if (lead != 0) // The lead stays free; it follows an allocated block, as bp did
+    {
+        heap->class_stats[position].splits++;
+        sf_block *aligned_block = (sf_block *)((void *)bp + lead);
+
+        aligned_block->header = GET_BLOCK_SIZE(&bp->header) - lead;
+        bp->header = lead | GET_PREV_ALLOC(&bp->header);
+        aligned_block->prev_footer = bp->header;
+        add_block_to_list(heap, bp, 0);
+        bp = aligned_block;
+    }
+
+    if (GET_BLOCK_SIZE(&bp->header) - rounded_size >= BLOCK_SZ)
+        split_block(heap, bp, rounded_size, position == NUM_FREE_LISTS - 1);
+    else
+    {
+        bp->header |= THIS_BLOCK_ALLOCATED;
+        (GET_NEXT_BLOCK(bp))->header |= PREV_BLOCK_ALLOCATED;
+    }
+
+    return bp->body.payload;
+}
+
+/*
+ * First fit for an aligned request: the first free block, from the request's size class up,
+ * with an aligned payload position that leaves room for size bytes; failing that, the
+ * wilderness, grown by just what the lead and the request need. *lead is the distance from
+ * the start of *found to the aligned block.
+ */
+int search_aligned_block(sf_heap *heap, size_t size, size_t align, sf_block **found, size_t *lead)
+{
+    sf_block *lists = heap->free_lists;
+    unsigned int candidates = heap->free_list_bitmap & (~0U << list_position(size)) & ~(1U << (NUM_FREE_LISTS - 1));
+
+    while (candidates != 0)
+    {
+        int i = __builtin_ctz(candidates);
+
+        for (sf_block *bp = lists[i].body.links.next; bp != &lists[i]; bp = bp->body.links.next)
+        {
+            *lead = (align - (uintptr_t)bp->body.payload % align) % align;
+
+            if (*lead + size <= GET_BLOCK_SIZE(&bp->header))
+            {
+                remove_block(heap, bp);
+                *found = bp;
+                return i;
+            }
+        }
+        candidates &= candidates - 1;
+    }
+
+    // The wilderness starts where it is, or at the epilogue while it is empty, however far it grows
+    sf_block *wilderness = heap->free_list_bitmap & (1U << (NUM_FREE_LISTS - 1)) ? lists[NUM_FREE_LISTS - 1].body.links.next : heap->epilogue;
+
+    *lead = (align - (uintptr_t)wilderness->body.payload % align) % align;
+
+    if ((*found = take_wilderness(heap, *lead + size)) == NULL)
+        return -1;
+
+    return NUM_FREE_LISTS - 1;
+}
+
+/*
+ * Large objects live in mappings of their own: the payload starts LARGE_HEADER_SZ bytes into
+ * the mapping, or a whole page in when it needs more than row alignment, so only pointers at
+ * those offsets in a page can be large (see large_base), and the table has the final say.
+ * Nothing about them is kept in any heap.
+ */
+void *large_malloc(size_t size)
+{
+    return large_memalign(size, LARGE_HEADER_SZ);
+}
+
+void *large_memalign(size_t size, size_t align)
+{
+    size_t offset = align <= LARGE_HEADER_SZ ? LARGE_HEADER_SZ : PAGE_SZ;
+    size_t length = round_to_page(size + offset);
+    size_t slack = align > PAGE_SZ ? align - PAGE_SZ : 0; // Room to slide the payload onto an align boundary
+    void *raw = mmap(NULL, length + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (raw == MAP_FAILED)
+        return NULL; // The caller falls back to the heap
+
+    void *base = raw;
+
+    if (slack != 0) // Unmap what is left on either side of the aligned mapping
+    {
+        base = (void *)(((uintptr_t)raw + offset + align - 1) & ~(uintptr_t)(align - 1)) - offset;
+
+        if (base != raw)
+            munmap(raw, base - raw);
+        if (base + length != raw + length + slack)
+            munmap(base + length, raw + slack - base);
+    }
+
+    lock_large();
+
+    if (!large_insert(base, length))
+    {
+        unlock_large();
+        munmap(base, length);
+        return NULL;
+    }
+
+    large_mallocs++;
+    unlock_large();
+    return base + offset;
+}
+
+void *large_base(void *pp)
+{
+    if ((uintptr_t)pp % PAGE_SZ == LARGE_HEADER_SZ)
+        return pp - LARGE_HEADER_SZ;
+    if ((uintptr_t)pp % PAGE_SZ == 0)
+        return pp - PAGE_SZ;
+    return NULL;
+}
+
+int large_free(void *pp)
+{
+    if (large_count == 0 || large_base(pp) == NULL)
+        return 0;
+
+    lock_large();
+
+    sf_large *entry = large_find(large_base(pp));
+
+    if (entry == NULL)
+    {
+        unlock_large();
+        return 0;
+    }
+
+    void *base = entry->base;
+    size_t length = entry->length;
+    entry->base = LARGE_TOMBSTONE;
+    large_tombstones++;
+    large_count--;
+    large_bytes -= length;
+    large_frees++;
+
+    unlock_large();
+    munmap(base, length); // The pages go straight back to the kernel
+
+    return 1;
+}
+
+void *large_realloc(void *pp, size_t rsize)
+{
+    lock_large();
+
+    sf_large *entry = large_find(large_base(pp));
+
+    if (entry == NULL)
+        abort();
+
+    // The kernel moves the page mappings, so no payload byte is copied; the payload keeps its
+    // offset into the mapping, though an alignment past a page may not survive the move
+    size_t offset = pp - entry->base;
+    size_t length = round_to_page(rsize + offset);
+    void *base = mremap(entry->base, entry->length, length, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED)
+    {
+        unlock_large();
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    entry->base = LARGE_TOMBSTONE;
+    large_tombstones++;
+    large_count--;
+    large_bytes -= entry->length;
+    large_insert(base, length); // Cannot fail: the slot just freed is there even if the table cannot be rebuilt
+
+    unlock_large();
+    return base + offset;
+}
+
+size_t large_realloc_in_place(void *pp, size_t rsize)
+{
+    lock_large();
+
+    sf_large *entry = large_find(large_base(pp));
+
+    if (entry == NULL)
+        abort();
+
+    // Without MREMAP_MAYMOVE the mapping grows only into free address space right after it
+    size_t offset = pp - entry->base;
+    size_t length = round_to_page(rsize + offset);
+
+    if (rsize != 0 && length != entry->length && mremap(entry->base, entry->length, length, 0) != MAP_FAILED)
+    {
+        large_bytes += length - entry->length;
+        entry->length = length;
+    }
+
+    size_t usable = entry->length - offset;
+    unlock_large();
+
+    return usable;
+}
+
+int is_large(void *pp)
+{
+    // Heap pointers seldom pass the offset check, so they rarely reach the table
+    if (large_count == 0 || large_base(pp) == NULL)
+        return 0;
+
+    lock_large();
+    int found = large_find(large_base(pp)) != NULL;
+    unlock_large();
+
+    return found;
+}
+
+sf_large *large_find(void *base)
+{
+    if (large_table == NULL)
+        return NULL;
+
+    size_t slot = ((uintptr_t)base / PAGE_SZ) & (large_capacity - 1);
+
+    for (size_t probes = 0; probes < large_capacity && large_table[slot].base != NULL; probes++)
+    {
+        if (large_table[slot].base == base)
+            return &large_table[slot];
+
+        slot = (slot + 1) & (large_capacity - 1);
+    }
+
+    return NULL;
+}
+
+int large_rehash(size_t capacity)
+{
+    sf_large *table = mmap(NULL, capacity * sizeof(sf_large), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (table == MAP_FAILED)
+        return 0;
+
+    for (size_t i = 0; i < large_capacity; i++)
+    {
+        void *base = large_table[i].base;
+
+        if (base == NULL || base == LARGE_TOMBSTONE)
+            continue;
+
+        size_t slot = ((uintptr_t)base / PAGE_SZ) & (capacity - 1);
+        while (table[slot].base != NULL)
+            slot = (slot + 1) & (capacity - 1);
+
+        table[slot] = large_table[i];
+    }
+
+    if (large_table != NULL)
+        munmap(large_table, large_capacity * sizeof(sf_large));
+
+    large_table = table;
+    large_capacity = capacity;
+    large_tombstones = 0;
+    return 1;
+}
+
+int large_insert(void *base, size_t length)
+{
+    // Rebuild once live entries and tombstones fill three quarters of the table, doubling it
+    // if live entries alone fill half; a failed rebuild still leaves any free slot usable
+    if ((large_count + large_tombstones + 1) * 4 > large_capacity * 3)
+    {
+        size_t capacity = large_capacity == 0 ? SF_LARGE_TABLE_SZ : large_capacity;
+
+        while ((large_count + 1) * 2 > capacity)
+            capacity *= 2;
+
+        large_rehash(capacity);
+    }
+
+    if ((size_t)large_count == large_capacity)
+        return 0;
+
+    size_t slot = ((uintptr_t)base / PAGE_SZ) & (large_capacity - 1);
+
+    while (large_table[slot].base != NULL && large_table[slot].base != LARGE_TOMBSTONE)
+        slot = (slot + 1) & (large_capacity - 1);
+
+    if (large_table[slot].base == LARGE_TOMBSTONE)
+        large_tombstones--;
+
+    large_table[slot].base = base;
+    large_table[slot].length = length;
+    large_count++;
+    large_bytes += length;
+    return 1;
+}
+
+void lock_large()
+{
+    if (heap_locking)
+        pthread_mutex_lock(&large_lock);
+}
+
+void unlock_large()
+{
+    if (heap_locking)
+        pthread_mutex_unlock(&large_lock);
+}
+
+size_t round_to_page(size_t size)
+{
+    return (size + PAGE_SZ - 1) & ~(size_t)(PAGE_SZ - 1);
+}
+
+sf_heap *thread_heap()
+{
+    if (arena_count == 1)
+        return &main_heap;
+
+    if (arena_policy == SF_ARENA_BY_CPU)
+    {
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+            return arena_at(cpu % arena_count);
+    }
+
+    if (thread_arena == NULL)
+    {
+        pthread_mutex_lock(&arenas_lock);
+        int index = next_arena++ % arena_count;
+        pthread_mutex_unlock(&arenas_lock);
+
+        thread_arena = arena_at(index);
+    }
+
+    return thread_arena;
+}
+
+sf_heap *arena_at(int index)
+{
+    if (index == 0)
+        return &main_heap;
+
+    pthread_mutex_lock(&arenas_lock);
+
+    while (arenas_created < index)
+    {
+        sf_heap *heap = &arenas[arenas_created];
+        void *base = mmap(NULL, SF_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (base == MAP_FAILED) // Threads that cannot get an arena of their own share main_heap
+        {
+            pthread_mutex_unlock(&arenas_lock);
+            return &main_heap;
+        }
+
+        heap->free_lists = arena_free_lists[arenas_created];
+        heap->mem_start = base;
+        heap->mem_end = base;
+        heap->mem_limit = base + SF_ARENA_SIZE;
+        pthread_mutex_init(&heap->lock, NULL);
+        __atomic_store_n(&arenas_created, arenas_created + 1, __ATOMIC_RELEASE); // arena_of reads this without the lock
+    }
+
+    pthread_mutex_unlock(&arenas_lock);
+    return &arenas[index - 1];
+}
+
+/*
+ * Fork handlers: the locks are taken in the order the allocator nests them, arenas_lock, then
+ * each heap's, then large_lock, so no thread can be holding one the child will need.
+ */
+void sf_fork_prepare()
+{
+    pthread_mutex_lock(&arenas_lock);
+    pthread_mutex_lock(&main_heap.lock);
+    for (int i = 0; i < arenas_created; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+    pthread_mutex_lock(&large_lock);
+}
+
+void sf_fork_parent()
+{
+    pthread_mutex_unlock(&large_lock);
+    for (int i = arenas_created - 1; i >= 0; i--)
+        pthread_mutex_unlock(&arenas[i].lock);
+    pthread_mutex_unlock(&main_heap.lock);
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+void sf_fork_child()
+{
+    // The child's only thread is the one that forked; new locks are simpler than handing these over
+    pthread_mutex_init(&large_lock, NULL);
+    for (int i = 0; i < arenas_created; i++)
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    pthread_mutex_init(&main_heap.lock, NULL);
+    pthread_mutex_init(&arenas_lock, NULL);
+}
+
+sf_heap *arena_of(void *pp)
+{
+    // Only a handful of arenas exist, so a range check per arena is cheap enough
+    int created = __atomic_load_n(&arenas_created, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < created; i++)
+    {
+        if (pp >= arenas[i].mem_start && pp < arenas[i].mem_end)
+            return &arenas[i];
+    }
+
+    return &main_heap; // Pointers that belong nowhere are rejected by main_heap's valid_pointer
+}
+
+void *heap_start(sf_heap *heap)
+{
+    return heap == &main_heap ? sf_mem_start() : heap->mem_start;
+}
+
+void *heap_end(sf_heap *heap)
+{
+    return heap == &main_heap ? sf_mem_end() : heap->mem_end;
+}
+
+int heap_grow(sf_heap *heap, int pages)
+{
+    int grown = 0;
+
+    if (heap == &main_heap)
+    {
+        int old_errno = sf_errno; // Callers decide whether falling short is an error
+
+        // sfutil hands out one page per call, but the caller only has to fix the heap up once
+        while (grown < pages && sf_mem_grow() != NULL)
+            grown++;
+
+        heap->grow_calls += grown;
+        if ((size_t)(heap_end(heap) - heap_start(heap)) > heap->peak_heap)
+            heap->peak_heap = heap_end(heap) - heap_start(heap);
+
+        heap->zero_from = heap_end(heap); // sfutil recycles one buffer across sf_mem_init, so its pages may be dirty
+        sf_errno = old_errno;
+        return grown;
+    }
+
+    // The reservation is already mapped, so growing only moves the end; the kernel backs pages on first touch
+    grown = (heap->mem_limit - heap->mem_end) / PAGE_SZ; // What is left of the reservation
+    if (grown > pages)
+        grown = pages;
+
+    heap->mem_end += grown * PAGE_SZ;
+    heap->grow_calls += grown;
+    if ((size_t)(heap->mem_end - heap->mem_start) > heap->peak_heap)
+        heap->peak_heap = heap->mem_end - heap->mem_start;
+
+    return grown;
+}
+
+void tcache_check_epoch()
+{
+    // sf_mem_init empties the sfutil heap without touching main_heap, whose layout then lives
+    // on until the next first call; retire it now so no cache hands out its blocks meanwhile
+    if (main_heap.prologue != NULL && sf_mem_start() == sf_mem_end())
+    {
+        lock_heap(&main_heap);
+        if (main_heap.prologue != NULL && sf_mem_start() == sf_mem_end())
+        {
+            main_heap.prologue = NULL;
+            main_heap.epoch++;
+        }
+        unlock_heap(&main_heap);
+    }
+
+    if (tcache.epoch == main_heap.epoch)
+        return;
+
+    // The heap was torn down and rebuilt since this thread last cached anything
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.counts, 0, sizeof(tcache.counts));
+    tcache.epoch = main_heap.epoch;
+}
+
+void *tcache_malloc(int rounded_size)
+{
+    int bin = rounded_size / BLOCK_SZ - 1;
+
+    tcache_check_epoch();
+
+    if (tcache.bins[bin] != NULL)
+        tcache.stats.malloc_hits++;
+    else
+    {
+        tcache.stats.malloc_misses++;
+        if (!tcache_refill(bin, rounded_size))
+            return NULL;
+    }
+
+    sf_block *bp = tcache.bins[bin];
+    tcache.bins[bin] = bp->body.links.next;
+    tcache.counts[bin]--;
+    bp->body.links.prev = NULL;
+
+    return bp->body.payload;
+}
+
+int tcache_refill(int bin, int rounded_size)
+{
+    int batch = (tcache_count + 1) / 2; // Half a bin per trip to the heap
+    int old_errno = sf_errno;
+    sf_heap *heap = thread_heap();
+
+    tcache_register();
+
+    lock_heap(heap);
+
+    for (int i = 0; i < batch; i++)
+    {
+        void *pp = malloc_block(heap, rounded_size);
+
+        if (pp == NULL)
+            break;
+
+        sf_block *bp = GET_BLOCK_FROM_PAYLOAD(pp);
+        bp->body.links.next = tcache.bins[bin];
+        bp->body.links.prev = (sf_block *)&tcache;
+        tcache.bins[bin] = bp;
+        tcache.counts[bin]++;
+    }
+
+    tcache.epoch = main_heap.epoch; // The first refill may be what laid out the heap
+    unlock_heap(heap);
+
+    if (tcache.bins[bin] == NULL)
+        return 0;
+
+    tcache.stats.refills++;
+    sf_errno = old_errno; // A short refill is not an error as long as one block came back
+    return 1;
+}
+
+void tcache_free(sf_block *bp)
+{
+    int bin = GET_BLOCK_SIZE(&bp->header) / BLOCK_SZ - 1;
+
+    tcache_check_epoch();
+
+    // The key says this block may already be cached; only a walk of the bin can tell for sure
+    if (bp->body.links.prev == (sf_block *)&tcache)
+    {
+        for (sf_block *cursor = tcache.bins[bin]; cursor != NULL; cursor = cursor->body.links.next)
+        {
+            if (cursor == bp)
+                abort();
+        }
+    }
+
+    tcache_register();
+
+    if (tcache.counts[bin] >= tcache_count)
+    {
+        tcache.stats.free_misses++;
+        tcache_flush_bin(bin, (tcache.counts[bin] + 1) / 2);
+    }
+    else
+        tcache.stats.free_hits++;
+
+    bp->body.links.next = tcache.bins[bin];
+    bp->body.links.prev = (sf_block *)&tcache;
+    tcache.bins[bin] = bp;
+    tcache.counts[bin]++;
+}
+
+/*
+ * Arranges for tcache_thread_exit to run when the calling thread exits, before it first
+ * caches a block.
+ */
+void tcache_register()
+{
+    if (tcache.registered)
+        return;
+
+    pthread_once(&tcache_key_once, tcache_create_key);
+    tcache.registered = pthread_setspecific(tcache_key, &tcache) == 0;
+}
+
+void tcache_create_key()
+{
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+/*
+ * Hands an exiting thread's cached blocks back to the heaps they came from, which would
+ * otherwise hold them allocated for good.
+ */
+void tcache_thread_exit(void *arg)
+{
+    tcache_check_epoch(); // Blocks of a heap since torn down are dropped, not freed
+
+    for (int bin = 0; bin < TCACHE_BINS; bin++)
+        tcache_flush_bin(bin, tcache.counts[bin]);
+}
+
+void tcache_flush_bin(int bin, int count)
+{
+    if (count <= 0)
+        return;
+
+    tcache.stats.flushes++;
+    sf_heap *locked = NULL; // Runs of blocks from the same arena share one trip through its lock
+
+    for (; count > 0 && tcache.bins[bin] != NULL; count--)
+    {
+        sf_block *bp = tcache.bins[bin];
+        sf_heap *heap = arena_of(bp);
+
+        if (heap != locked)
+        {
+            if (locked != NULL)
+                unlock_heap(locked);
+            lock_heap(heap);
+            locked = heap;
+        }
+
+        tcache.bins[bin] = bp->body.links.next;
+        tcache.counts[bin]--;
+        free_block(heap, bp);
+    }
+
+    if (locked != NULL)
+        unlock_heap(locked);
+}
+
+void shrink_block(sf_heap *heap, sf_block *bp, int rounded_size)
+{
+    if (GET_BLOCK_SIZE(&bp->header) < rounded_size + BLOCK_SZ) // The remainder would be a splinter
+        return;
+
+    sf_block *remainder = (sf_block *)(((void *)bp) + rounded_size);
+
+    heap->class_stats[list_position(GET_BLOCK_SIZE(&bp->header))].splits++;
+
+    // The remainder starts out as an allocated block that follows bp, so free_block can coalesce it.
+    remainder->header = (GET_BLOCK_SIZE(&bp->header) - rounded_size) | PREV_BLOCK_ALLOCATED | THIS_BLOCK_ALLOCATED;
+    bp->header = bp->header - GET_BLOCK_SIZE(&bp->header) + rounded_size;
+
+    release_block(heap, remainder);
+}
+
+sf_block *coalesce(sf_block *bp, sf_block *next_block)
+{
+    bp->header += GET_BLOCK_SIZE(&next_block->header);
+    (GET_NEXT_BLOCK(bp))->prev_footer = bp->header;
+
+    return bp;
+}
+
+int valid_pointer(sf_heap *heap, void *pp)
+{
+    if (pp == NULL) // The pointer is NULL
+        abort();
+
+    if (((uintptr_t)pp) % BLOCK_SZ != 0) // The pointer is not aligned to a 64-byte boundary
+        abort();
+
+    sf_block *bp = GET_BLOCK_FROM_PAYLOAD(pp);
+
+    if (bp <= heap->prologue) // The header of the block is before the end of the prologue
+        abort();
+
+    if (bp >= heap->epilogue) // The footer of the block is after the beginning of the epilogue
+        abort();
+
+    if (!IS_ALLOC(&bp->header)) // The allocated bit in the header is 0
+        abort();
+
+    if (GET_BLOCK_SIZE(&bp->header) < BLOCK_SZ || GET_NEXT_BLOCK(bp) > heap->epilogue) // The block size is impossible
+        abort();
+
+    // The prev_alloc field is 0 but the previous block is not free. When prev_alloc is 0 the
+    // prev_footer row is a real footer, so its alloc bit describes the previous block.
+    if ((IS_PREV_ALLOC(&bp->header) == 0) && (IS_ALLOC(&bp->prev_footer) != 0))
+        abort();
+
+    return 1;
+}
+
+/*
+ * valid_pointer for callers without the heap's lock.  Freeing the block in front rewrites
+ * this block's PREV_BLOCK_ALLOCATED bit and prev_footer under the lock, so neither is read;
+ * the rest of the header is written only by whoever owns the block.
+ */
+int valid_owned_pointer(sf_heap *heap, void *pp)
+{
+    if (pp == NULL || ((uintptr_t)pp) % BLOCK_SZ != 0)
+        abort();
+
+    sf_block *bp = GET_BLOCK_FROM_PAYLOAD(pp);
+
+    if (bp <= heap->prologue || bp >= heap->epilogue)
+        abort();
+
+    sf_header header = __atomic_load_n(&bp->header, __ATOMIC_RELAXED) & ~PREV_BLOCK_ALLOCATED;
+
+    if (!IS_ALLOC(&header))
+        abort();
+
+    if (GET_BLOCK_SIZE(&header) < BLOCK_SZ || (void *)bp + GET_BLOCK_SIZE(&header) > (void *)heap->epilogue)
+        abort();
+
+    return 1;
+}
+
+void split_block(sf_heap *heap, sf_block *bp, size_t size, int is_wilderness)
+{
+    sf_block *new_block_ptr = (sf_block *)(((void *)bp) + size);
+
+    heap->class_stats[is_wilderness ? NUM_FREE_LISTS - 1 : list_position(GET_BLOCK_SIZE(&bp->header))].splits++;
+
+    new_block_ptr->header = (GET_BLOCK_SIZE(&bp->header) - size) | PREV_BLOCK_ALLOCATED;
+    bp->header = size | GET_PREV_ALLOC(&bp->header) | THIS_BLOCK_ALLOCATED;
+
+    (GET_NEXT_BLOCK(new_block_ptr))->prev_footer = new_block_ptr->header;
+
+    add_block_to_list(heap, new_block_ptr, is_wilderness);
+}
+
+int search_empty_block(sf_heap *heap, size_t size, sf_block **found)
+{
+    sf_block *lists = heap->free_lists;
+    int i = list_position(size);
+    sf_block *traverse_block;
+
+    // Only the non-empty size classes at or above the request's class, never the wilderness
+    unsigned int candidates = heap->free_list_bitmap & (~0U << i) & ~(1U << (NUM_FREE_LISTS - 1));
+
+    // First-fit and address-ordered take the first block that fits; the others keep the
+    // smallest of up to limit fitting blocks, stopping early on an exact fit
+    int limit = fit_policy == SF_FIT_BEST ? INT_MAX : fit_policy == SF_FIT_GOOD ? fit_candidates : 1;
+
+    while (candidates != 0)
+    {
+        i = __builtin_ctz(candidates);
+        sf_block *best = NULL;
+        int seen = 0;
+
+        traverse_block = lists[i].body.links.next;
+        while (traverse_block != &lists[i] && seen < limit)
+        {
+            size_t block_size = GET_BLOCK_SIZE(&traverse_block->header);
+
+            if (block_size >= size)
+            {
+                if (best == NULL || block_size < GET_BLOCK_SIZE(&best->header))
+                    best = traverse_block;
+                if (block_size == size)
+                    break;
+                seen++;
+            }
+            traverse_block = traverse_block->body.links.next;
+        }
+
+        if (best != NULL)
+        {
+            remove_block(heap, best);
+            *found = best;
+            return i;
+        }
+        candidates &= candidates - 1;
+    }
+
+    // No size class can satisfy the request, so use the wilderness
+    if ((*found = take_wilderness(heap, size)) == NULL)
+        return -1;
+
+    return NUM_FREE_LISTS - 1;
+}
+
+sf_block *take_wilderness(sf_heap *heap, size_t size)
+{
+    sf_block *lists = heap->free_lists;
+    sf_block *wilderness;
+
+    // The epilogue stands in for an empty wilderness
+    if (heap->free_list_bitmap & (1U << (NUM_FREE_LISTS - 1)))
+        wilderness = lists[NUM_FREE_LISTS - 1].body.links.next;
+    else
+    {
+        wilderness = heap->epilogue;
+        wilderness->header = GET_PREV_ALLOC(&wilderness->header);
+    }
+
+    size_t available_space = GET_BLOCK_SIZE(&wilderness->header);
+
+    if (size > available_space)
+    {
+        int pages = (size - available_space + PAGE_SZ - 1) / PAGE_SZ;
+
+        if (growth_policy == SF_GROWTH_GEOMETRIC)
+        {
+            pages = pages > heap->grow_pages ? pages : heap->grow_pages;
+            heap->grow_pages = heap->grow_pages * 2 < SF_GROW_MAX_PAGES ? heap->grow_pages * 2 : SF_GROW_MAX_PAGES;
+        }
+
+        // Whatever was grown joins the wilderness, even if it falls short of the request
+        int grown = heap_grow(heap, pages);
+
+        if (grown == 0)
+        {
+            if (available_space == 0) // Nothing was grown, so the epilogue is still an epilogue
+                wilderness->header |= THIS_BLOCK_ALLOCATED;
+            return NULL;
+        }
+
+        available_space += grown * PAGE_SZ;
+        wilderness->header += grown * PAGE_SZ;
+
+        // The old epilogue now sits inside the wilderness; keep the untouched stretch zero
+        if (wilderness != heap->epilogue && (void *)heap->epilogue >= heap->zero_from)
+            memset(heap->epilogue, 0, 2 * sizeof(sf_header));
+
+        add_epilogue(heap, wilderness);
+        add_block_to_list(heap, wilderness, 1);
+
+        if (size > available_space)
+            return NULL;
+    }
+
+    remove_block(heap, wilderness);
+
+    // The caller hands out size bytes and leaves what remains as the wilderness, whose tags and
+    // links stay behind in the middle of the heap once it coalesces with a block below it
+    if ((void *)wilderness + size + WILDERNESS_TAGS_SZ > heap->zero_from)
+        heap->zero_from = (void *)wilderness + size + WILDERNESS_TAGS_SZ;
+
+    return wilderness;
+}
+
+void add_block_to_list(sf_heap *heap, sf_block *block_to_add, int is_wilderness)
+{
+    sf_block *lists = heap->free_lists;
+    int position;
+
+    if (is_wilderness)
+    {
+        block_to_add->header = GET_BLOCK_SIZE(&block_to_add->header) + GET_PREV_ALLOC(&block_to_add->header);
+        block_to_add->body.links.next = &lists[NUM_FREE_LISTS - 1];
+        block_to_add->body.links.prev = &lists[NUM_FREE_LISTS - 1];
+        lists[NUM_FREE_LISTS - 1].body.links.next = block_to_add;
+        lists[NUM_FREE_LISTS - 1].body.links.prev = block_to_add;
+
+        heap->epilogue->prev_footer = block_to_add->header;
+        position = NUM_FREE_LISTS - 1;
+    }
+    else
+    {
+        position = list_position(GET_BLOCK_SIZE(&block_to_add->header));
+
+        sf_block *after = &lists[position];
+
+        // Address order keeps each class sorted so first-fit favours the bottom of the heap;
+        // otherwise blocks are pushed to the front
+        if (fit_policy == SF_FIT_ADDRESS)
+            while (after->body.links.next != &lists[position] && after->body.links.next < block_to_add)
+                after = after->body.links.next;
+
+        block_to_add->body.links.next = after->body.links.next;
+        block_to_add->body.links.prev = after;
+        after->body.links.next->body.links.prev = block_to_add;
+        after->body.links.next = block_to_add;
+
+        if (position == NUM_FREE_LISTS - 2) // Only the last class is big enough to span whole pages
+        {
+            if (purge_decay_ms == 0)
+                purge_block(block_to_add);
+            else
+                PURGE_STAMP(block_to_add) = purge_decay_ms > 0 ? purge_clock_ms() : 1;
+        }
+    }
+
+    heap->free_list_bitmap |= 1U << position;
+}
+
+int remove_block(sf_heap *heap, sf_block *block_to_remove)
+{
+#ifdef DEBUG_FREE_LISTS
+    // Debug builds confirm the block really is linked into its list before touching the links
+    if (!block_in_list(heap, block_to_remove))
+        return 0;
+#endif
+
+    block_to_remove->body.links.next->body.links.prev = block_to_remove->body.links.prev;
+    block_to_remove->body.links.prev->body.links.next = block_to_remove->body.links.next;
+
+    if (block_to_remove->body.links.next == block_to_remove->body.links.prev) // Only the dummy head is left
+    {
+        int position = block_to_remove->body.links.next - heap->free_lists;
+
+        heap->free_list_bitmap &= ~(1U << position);
+
+        if (position == NUM_FREE_LISTS - 1) // Whoever takes the wilderness may touch its released pages
+            heap->released = NULL;
+    }
+
+    return 1;
+}
+
+#ifdef DEBUG_FREE_LISTS
+int block_in_list(sf_heap *heap, sf_block *block_to_find)
+{
+    int position = list_position(GET_BLOCK_SIZE(&block_to_find->header));
+
+    if (GET_NEXT_BLOCK(block_to_find) == heap->epilogue) // The wilderness lives in the last list
+        position = NUM_FREE_LISTS - 1;
+
+    sf_block *cursor = heap->free_lists[position].body.links.next;
+
+    while (cursor != block_to_find)
+    {
+        if (cursor == &heap->free_lists[position])
+            return 0;
+
+        cursor = cursor->body.links.next;
+    }
+
+    return 1;
+}
+#endif
+
+/*
+ * Size class of a block of n minimum-size units, following the Fibonacci bounds
+ * 1, 2, 3, 5, 8, 13, 21, 34; anything above 34M falls into list NUM_FREE_LISTS-2.
+ */
+#define SIZE_CLASS_OF(n) ((n) <= 1 ? 0 : (n) <= 2 ? 1 : (n) <= 3 ? 2 : (n) <= 5 ? 3 : (n) <= 8 ? 4 : \
+                          (n) <= 13 ? 5 : (n) <= 21 ? 6 : (n) <= 34 ? 7 : NUM_FREE_LISTS - 2)
+#define SIZE_CLASS_ROW(n) SIZE_CLASS_OF(n), SIZE_CLASS_OF(n + 1), SIZE_CLASS_OF(n + 2), SIZE_CLASS_OF(n + 3), \
+                          SIZE_CLASS_OF(n + 4), SIZE_CLASS_OF(n + 5), SIZE_CLASS_OF(n + 6), SIZE_CLASS_OF(n + 7)
+
+// Indexed by the size in minimum-size units, with the last entry covering everything above 34M
+static const unsigned char size_class_table[SIZE_CLASS_UNITS + 1] = {
+    SIZE_CLASS_ROW(0), SIZE_CLASS_ROW(8), SIZE_CLASS_ROW(16), SIZE_CLASS_ROW(24),
+    SIZE_CLASS_OF(32), SIZE_CLASS_OF(33), SIZE_CLASS_OF(34), SIZE_CLASS_OF(35)};
+
+int list_position(size_t num_bytes)
+{
+    size_t units = (num_bytes + BLOCK_SZ - 1) / BLOCK_SZ;
+
+    // Clamp instead of branching so large sizes share the last table entry (compiles to a cmov)
+    units = units < SIZE_CLASS_UNITS ? units : SIZE_CLASS_UNITS;
+
+    return size_class_table[units];
+}
+
+int round_to_64(size_t size)
+{
+    if (size % BLOCK_SZ == 0)
+        return size;
+
+    return size + BLOCK_SZ - (size % BLOCK_SZ);
+}
+
+void add_epilogue(sf_heap *heap, sf_block *last_block)
+{
+    heap->epilogue = (sf_block *)(heap_end(heap) - (2 * sizeof(sf_header))); // Heap end - 8
+    heap->epilogue->header = THIS_BLOCK_ALLOCATED;
+    if (IS_ALLOC(&last_block->header))
+        heap->epilogue->header |= PREV_BLOCK_ALLOCATED;
+    heap->epilogue->prev_footer = last_block->header;
+}
+
+int first_call_to_sf_malloc(sf_heap *heap)
+{
+    // The counters describe this layout of the heap, whose first page is about to be added
+    memset(heap->class_stats, 0, sizeof(heap->class_stats));
+    heap->peak_heap = 0;
+    heap->grow_calls = 0;
+
+    if (heap_grow(heap, 1) == 0) // No memory is left
+        return -1;
+
+    void *mem_grow_ptr = heap_start(heap);
+    init_lists(heap);
+    init_slabs(heap);
+    heap->grow_pages = 1;
+    heap->released = NULL;
+    heap->zero_from = heap == &main_heap ? heap_end(heap) : heap_start(heap) + INITIAL_PADDING + BLOCK_SZ + WILDERNESS_TAGS_SZ; // Arenas start on fresh anonymous pages
+    heap->epoch++;
+
+    // Insert padding (48) and Prologue (64)
+    heap->prologue = (sf_block *)(mem_grow_ptr + INITIAL_PADDING); // INITIAL_PADDING  = 48
+    heap->prologue->header = BLOCK_SZ + 3;                         // 64 for the block size and 3 for prev and current block being allocated
 
-void *mem_grow_ptr;
-void *mem_end_ptr;
-int position_in_list;
+    sf_block *wilderness = (sf_block *)(mem_grow_ptr + INITIAL_PADDING + BLOCK_SZ);
+    wilderness->header = PAGE_SZ - (INITIAL_PADDING + BLOCK_SZ + (2 * sizeof(sf_header))) + 2; // PAGE_SZ - sizeof(initial padding) - sizeof(prologue) - sizeof(epilogue)
+    wilderness->prev_footer = heap->prologue->header;
 
-sf_block *prologue_ptr;
-sf_block *epilogue_ptr;
-sf_block *curr_block_ptr;
-sf_block *block_to_coalesce;
+    add_epilogue(heap, wilderness);
+    add_block_to_list(heap, wilderness, 1);
 
-sf_block *prev_block_get_blocks;
-sf_block *temp_block_get_blocks;
-sf_block *next_block_get_blocks;
+    return 1;
+}
 
-void *sf_malloc(size_t size)
+void init_lists(sf_heap *heap)
 {
-    if (size <= 0)
-        return NULL;
+    // If the list is empty, then the fields free_lists[i].body.links.next
+    // and free_lists[i].body.links.prev both contain &free_lists[i]
 
-    if ((sf_mem_start() == sf_mem_end()) && first_call_to_sf_malloc() == -1)
+    for (int i = 0; i < NUM_FREE_LISTS; i++)
     {
-        sf_errno = ENOMEM;
-        return NULL;
+        heap->free_lists[i].body.links.next = &heap->free_lists[i];
+        heap->free_lists[i].body.links.prev = &heap->free_lists[i];
     }
 
-    int rounded_size = round_to_64(size + sizeof(sf_header));
-    curr_block_ptr = NULL;
-    int found_empty_block = search_empty_block(rounded_size);
+    heap->free_list_bitmap = 0;
+}
 
-    if (found_empty_block == -1)
+void count_num_blocks(int pos, int size)
+{
+    sf_block *tmp = sf_free_list_heads[pos].body.links.next;
+    int counter = 0;
+
+    while (tmp != &sf_free_list_heads[pos])
     {
-        sf_errno = ENOMEM;
-        return NULL;
+        counter += 1;
+        tmp = tmp->body.links.next;
     }
+}
+
+int is_power_of_2(size_t value)
+{
 
-    if (GET_BLOCK_SIZE(&curr_block_ptr->header) - rounded_size >= BLOCK_SZ) // Split the current block
+    if (value == 0 || value == 1)
+        return 1;
+
+    size_t old_value = value;
+    while (value > 1)
     {
-        if (found_empty_block >= NUM_FREE_LISTS - 1)
-            split_block(rounded_size, 1);
-        else
-            split_block(rounded_size, 0);
+        old_value = value;
+        value /= 2;
+        if (value * 2 != old_value)
+            return 0;
     }
-    else
+    if (value != 1)
+        return 0;
+    return value;
+}
+
+void sf_latency_merge(struct sf_latency *into)
+{
+#ifdef SF_LATENCY
+    int claimed = __atomic_load_n(&latency_claimed, __ATOMIC_RELAXED);
+
+    for (int slot = 0; slot < claimed && slot < SF_LATENCY_THREADS; slot++)
     {
-        remove_block_from_list();
-        get_blocks();
+        size_t *from = &latency_slots[slot].ops[0][0].counts[0];
+        size_t *to = &into->ops[0][0].counts[0];
 
-        if (IS_ALLOC(prev_block_get_blocks) == 1)
-            curr_block_ptr->header += 2;
-        curr_block_ptr->header += 1;
+        // Owners keep counting while this reads, so each count is loaded whole
+        for (size_t i = 0; i < sizeof(struct sf_latency) / sizeof(size_t); i++)
+            to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
     }
+#endif
+}
 
-    clear_empty_blocks();
-    return curr_block_ptr->body.payload;
+void sf_latency_reset()
+{
+#ifdef SF_LATENCY
+    memset(latency_slots, 0, sizeof(latency_slots));
+#endif
 }
 
-void sf_free(void *pp)
+double sf_latency_percentile(const struct sf_latency_histogram *histogram, double q)
 {
-    if (!valid_pointer(pp))
-        abort();
+    size_t total = 0, seen = 0;
 
-    curr_block_ptr->header -= 1; // Free the block
-    sf_block *wilderness_block = sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next;
+    for (int i = 0; i < SF_LATENCY_BUCKETS; i++)
+        total += histogram->counts[i];
 
-    // Case 1: Prev and Next
-    if ((GET_ALLOC(&prev_block_get_blocks->header)) && (GET_ALLOC(&next_block_get_blocks->header)))
-        debug("Prev and Next");
-    
-    // Case 2: Prev and !Next
-    else if ((&next_block_get_blocks->header != &epilogue_ptr->header) && (GET_ALLOC(&prev_block_get_blocks->header)) && (!GET_ALLOC(&next_block_get_blocks->header)))
-    {
-        block_to_coalesce = next_block_get_blocks;
+    if (total == 0)
+        return 0;
 
-        if (!remove_block(block_to_coalesce))
-            debug("ERROR IN PREV AND !NEXT");
+    size_t rank = q * total; // The sample at this rank, counting from 0, is the one asked for
+    if (rank >= total)
+        rank = total - 1;
 
-        coalesce();
+    for (int i = 0; i < SF_LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen > rank)
+            return latency_bucket_limit(i) * latency_ns_per_tick();
     }
 
-    // Case 3: !Prev and Next
-    else if ((&prev_block_get_blocks->header != &prologue_ptr->header) && (!GET_ALLOC(&prev_block_get_blocks->header)) && (GET_ALLOC(&next_block_get_blocks->header)))
-    {
-        block_to_coalesce = curr_block_ptr;
-        curr_block_ptr = prev_block_get_blocks;
+    return 0;
+}
 
-        if (!remove_block(prev_block_get_blocks))
-            debug("ERROR IN !PREV AND NEXT");
+void sf_latency_dump(const struct sf_latency *latency, FILE *out)
+{
+    static const char *names[SF_OP_COUNT] = {"malloc", "free", "realloc", "memalign", "free_sized",
+                                             "realloc_in_place", "calloc", "malloc_batch", "free_batch"};
 
-        coalesce();
-    }
+    fprintf(out, "op,class,count,p50_ns,p99_ns,p999_ns\n");
 
-    // Case 4: !Prev and !Next
-    else if ((!GET_ALLOC(&prev_block_get_blocks->header)) && (!GET_ALLOC(&next_block_get_blocks->header)))
+    for (int op = 0; op < SF_OP_COUNT; op++)
     {
-        if (&prev_block_get_blocks->header != &prologue_ptr->header)
-        {
-            block_to_coalesce = curr_block_ptr;
-            curr_block_ptr = prev_block_get_blocks;
-            if (!remove_block(prev_block_get_blocks))
-                debug("ERROR IN !PREV AND NEXT PART OF !PREV AND !NEXT");
-            
-            coalesce();
-        }
-        if (&next_block_get_blocks->header != &epilogue_ptr->header)
+        for (int c = 0; c < NUM_FREE_LISTS; c++)
         {
-            block_to_coalesce = next_block_get_blocks;
+            const struct sf_latency_histogram *histogram = &latency->ops[op][c];
+            size_t count = 0;
+
+            for (int i = 0; i < SF_LATENCY_BUCKETS; i++)
+                count += histogram->counts[i];
 
-            if (!remove_block(block_to_coalesce))
-                debug("ERROR IN PREV AND !NEXT");
-            
-            coalesce();
+            if (count != 0)
+                fprintf(out, "%s,%d,%zu,%.0f,%.0f,%.0f\n", names[op], c, count,
+                        sf_latency_percentile(histogram, 0.5),
+                        sf_latency_percentile(histogram, 0.99),
+                        sf_latency_percentile(histogram, 0.999));
         }
     }
+}
 
-    (GET_NEXT_BLOCK(curr_block_ptr))->prev_footer = curr_block_ptr->header;
+/*
+ * Log-linear bucket of a latency: one bucket per tick below SF_LATENCY_SUB_BUCKETS, then
+ * SF_LATENCY_SUB_BUCKETS buckets per power of two, picked by the bits below the leading one.
+ */
+int latency_bucket(uint64_t ticks)
+{
+    if (ticks < SF_LATENCY_SUB_BUCKETS)
+        return ticks;
 
-    if (wilderness_block != block_to_coalesce && &sf_free_list_heads[NUM_FREE_LISTS - 1] != sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next)
-        add_block_to_list(curr_block_ptr, 0);
-    else
-        add_block_to_list(curr_block_ptr, 1);
+    int exp = 63 - __builtin_clzll(ticks); // At least log2(SF_LATENCY_SUB_BUCKETS)
+
+    if (exp >= SF_LATENCY_MAX_EXP)
+        return SF_LATENCY_BUCKETS - 1;
+
+    int shift = exp - __builtin_ctz(SF_LATENCY_SUB_BUCKETS);
+
+    return (shift + 1) * SF_LATENCY_SUB_BUCKETS + ((ticks >> shift) & (SF_LATENCY_SUB_BUCKETS - 1));
 }
 
-void *sf_realloc(void *pp, size_t rsize)
+/*
+ * First tick count past bucket, the inverse of latency_bucket.
+ */
+uint64_t latency_bucket_limit(int bucket)
 {
-    if (valid_pointer(pp))
-    {
-        if (rsize == 0)
-        {
-            sf_free(pp);
-            return NULL;
-        }
-    }
-    else
-        abort();
-
-    sf_block *pp_block = GET_BLOCK_FROM_PAYLOAD(pp);
-    int rounded_rsize = round_to_64(rsize + sizeof(sf_header));
+    if (bucket < SF_LATENCY_SUB_BUCKETS)
+        return bucket + 1;
 
-    if (GET_BLOCK_SIZE(&pp_block->header) < rounded_rsize)
-    {
-        sf_block *tmp_ptr = sf_malloc(rsize);
+    int shift = bucket / SF_LATENCY_SUB_BUCKETS - 1;
 
-        if (tmp_ptr == NULL)
-            return NULL;
+    return (uint64_t)(SF_LATENCY_SUB_BUCKETS + bucket % SF_LATENCY_SUB_BUCKETS + 1) << shift;
+}
 
-        int x = memcmp(tmp_ptr, pp, rsize);
-        x += 2;
+uint64_t latency_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
 
-        sf_free(pp);
+/*
+ * Nanoseconds per latency_ticks tick. The cycle counter runs at a fixed rate, so it is
+ * measured once against the monotonic clock, over SF_LATENCY_CALIBRATE_MS.
+ */
+double latency_ns_per_tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double ns_per_tick;
 
-        return tmp_ptr;
-    }
-    else if (GET_BLOCK_SIZE(&pp_block->header) > rounded_rsize)
+    if (ns_per_tick == 0)
     {
-        if (GET_BLOCK_SIZE(&pp_block->header) >= rounded_rsize + BLOCK_SZ)
-        {
-            sf_block *temp_block_ptr = (sf_block *)(((void *)pp_block) + (rounded_rsize));
+        struct timespec before, after, pause = {0, SF_LATENCY_CALIBRATE_MS * 1000000L};
 
-            temp_block_ptr->header = pp_block->header - rounded_rsize;
-            pp_block->header = pp_block->header - GET_BLOCK_SIZE(&pp_block->header) + rounded_rsize;
-            temp_block_ptr->prev_footer = pp_block->header;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        uint64_t start = __rdtsc();
+        nanosleep(&pause, NULL);
+        uint64_t ticks = __rdtsc() - start;
+        clock_gettime(CLOCK_MONOTONIC, &after);
 
-            (GET_NEXT_BLOCK(pp_block))->prev_footer = pp_block->header;
-
-            sf_free(temp_block_ptr->body.payload);
-        }
+        ns_per_tick = ((after.tv_sec - before.tv_sec) * 1e9 + (after.tv_nsec - before.tv_nsec)) / ticks;
     }
 
-    return pp;
+    return ns_per_tick;
+#else
+    return 1;
+#endif
 }
 
-void *sf_memalign(size_t size, size_t align)
+#ifdef SF_LATENCY
+void latency_record(int op, size_t size, uint64_t ticks)
 {
-    if (align < BLOCK_SZ || !is_power_of_2(align))
+    if (latency_slot == NULL)
     {
-        sf_errno = EINVAL;
-        return NULL;
+        int slot = __atomic_fetch_add(&latency_claimed, 1, __ATOMIC_RELAXED);
+        latency_slot = &latency_slots[slot < SF_LATENCY_THREADS ? slot : SF_LATENCY_THREADS - 1];
     }
 
-    int malloc_size = size + align + BLOCK_SZ; // sizeof(sf_header) is already added in malloc
-    curr_block_ptr = GET_BLOCK_FROM_PAYLOAD(sf_malloc(malloc_size));
+    size_t *count = &latency_slot->ops[op][list_position(size + sizeof(sf_header))].counts[latency_bucket(ticks)];
+
+    if (latency_slot == &latency_slots[SF_LATENCY_THREADS - 1])
+        __atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED); // A plain add, but one sf_latency_merge never sees torn
+}
+#endif
+
+int sf_trace_start(const char *path)
+{
+#ifdef SF_TRACE
+    pthread_mutex_lock(&trace_lock);
 
-    int new_align = align - INITIAL_PADDING + (2 * sizeof(sf_header));
+    int fd = trace_fd < 0 ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    struct sf_trace_header header = {.ns_per_tick = latency_ns_per_tick(), .start_ticks = latency_ticks()};
 
-    sf_block *block_to_free_after = (sf_block *)(((void *)curr_block_ptr) + new_align);
+    memcpy(header.magic, SF_TRACE_MAGIC, sizeof(header.magic));
 
-    if (align == BLOCK_SZ)
+    if (fd < 0 || !trace_write(fd, &header, sizeof(header)))
     {
-        if(GET_BLOCK_SIZE(&block_to_free_after->header) >= round_to_64(size) + BLOCK_SZ)
-            return sf_realloc(block_to_free_after->body.payload, size);
-        return curr_block_ptr->body.payload;
+        if (fd >= 0)
+            close(fd);
+        pthread_mutex_unlock(&trace_lock);
+        return 0;
     }
-    else
+
+    // Whatever an earlier trace left in the rings, from calls under way as it stopped, is stale
+    for (int slot = 0; slot < SF_TRACE_THREADS; slot++)
     {
-        if ((curr_block_ptr->header & PREV_BLOCK_ALLOCATED) == 2)
-            curr_block_ptr->header = new_align + 3;
-        else
-            curr_block_ptr->header = new_align + 1;
+        sf_trace_ring *ring = __atomic_load_n(&trace_rings[slot], __ATOMIC_ACQUIRE);
+
+        if (ring != NULL)
+        {
+            __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+            __atomic_store_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_store_n(&trace_slotless, 0, __ATOMIC_RELAXED);
 
-        block_to_free_after->prev_footer = curr_block_ptr->header;
-        
-        block_to_free_after->header = round_to_64(malloc_size) - GET_BLOCK_SIZE(&curr_block_ptr->header) + 3;
+    trace_fd = fd;
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
 
-        (GET_NEXT_BLOCK(block_to_free_after))->prev_footer = block_to_free_after->header;    
-        sf_free(curr_block_ptr->body.payload);
-        sf_realloc(block_to_free_after->body.payload, size);
+    if (pthread_create(&trace_flusher, NULL, trace_flush_loop, NULL) != 0)
+    {
+        __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+        close(trace_fd);
+        trace_fd = -1;
+        pthread_mutex_unlock(&trace_lock);
+        return 0;
     }
-    
-    return curr_block_ptr->body.payload;
-}
 
-void coalesce()
-{
-    curr_block_ptr->header += GET_BLOCK_SIZE(&block_to_coalesce->header);
-    (GET_NEXT_BLOCK(curr_block_ptr))->prev_footer = curr_block_ptr->header;
+    pthread_mutex_unlock(&trace_lock);
+    return 1;
+#else
+    return 0;
+#endif
 }
 
-int valid_pointer(void *pp)
+void sf_trace_stop()
 {
-    curr_block_ptr = GET_BLOCK_FROM_PAYLOAD(pp);
-    get_blocks();
+#ifdef SF_TRACE
+    pthread_mutex_lock(&trace_lock);
 
-    if (pp == NULL) // The pointer is NULL
-        abort();
-    
-    if (((((void *)&epilogue_ptr->header) - ((void *)&curr_block_ptr->header)) % 64) != 0) // The pointer is not aligned to a 64-byte boundary
-        abort();
-    
-    if (!IS_ALLOC(&curr_block_ptr->header)) // The allocated bit in the header is 0
-        abort();
-    
-    if (curr_block_ptr >= epilogue_ptr) // The header of the block is before the end of the prologue
-        abort();
-    
-    if (curr_block_ptr <= prologue_ptr) // The footer of the block is after the beginning of the epilogue
-        abort();
-    
-    if ((IS_PREV_ALLOC(&curr_block_ptr->header) == 0) && (IS_ALLOC(&prev_block_get_blocks->header) != 0)) // The prev_alloc field is 0 but the alloc field of the previous block header is not 0.
-        abort();
-    
-    return 1;
+    if (trace_fd >= 0)
+    {
+        __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+        pthread_join(trace_flusher, NULL); // It drains the rings once more on its way out
+        close(trace_fd);
+        trace_fd = -1;
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+#endif
 }
 
-void split_block(size_t size, int is_wilderness)
+#ifdef SF_TRACE
+void trace_record(int op, size_t size, size_t align, void *pp, void *old_pp, uint64_t begin, uint64_t end)
 {
-    sf_block *new_block_ptr = (sf_block *)(((void *)curr_block_ptr) + size);
+    if (trace_slot == 0 && !trace_claim_slot())
+    {
+        __atomic_fetch_add(&trace_slotless, 1, __ATOMIC_RELAXED); // A later call tries again
+        return;
+    }
 
-    new_block_ptr->header = curr_block_ptr->header - size;
-    curr_block_ptr->header = size + 3;
-    new_block_ptr->prev_footer = curr_block_ptr->header;
+    if (trace_slot > SF_TRACE_THREADS)
+        return;
 
-    (GET_NEXT_BLOCK(new_block_ptr))->prev_footer = new_block_ptr->header;
+    sf_trace_ring *ring = trace_rings[trace_slot - 1];
 
-    add_block_to_list(new_block_ptr, is_wilderness);
-}
+    if (ring == NULL && (ring = trace_claim_ring()) == NULL)
+        return;
 
-int search_empty_block(size_t size)
-{
-    position_in_list = list_position(size);
-    int i = position_in_list;
-    sf_block *traverse_block;
+    uint64_t head = ring->head;
 
-    for (; i < NUM_FREE_LISTS; i++)
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SF_TRACE_RING_EVENTS)
     {
-        if (&sf_free_list_heads[i] == sf_free_list_heads[i].body.links.next) {}
-        else
-        {
-            traverse_block = sf_free_list_heads[i].body.links.next;
-            while (traverse_block != &sf_free_list_heads[i])
-            {
-                if (GET_BLOCK_SIZE(&traverse_block->header) >= size)
-                {
-                    curr_block_ptr = traverse_block;
-                    break;
-                }
-                traverse_block = traverse_block->body.links.next;
-            }
-            if (&curr_block_ptr->header == &traverse_block->header)
-                break;
-        }
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED); // Waiting for the flusher would stall the caller
+        return;
     }
 
-    if (curr_block_ptr == traverse_block)
+    struct sf_trace_event *event = &ring->events[head % SF_TRACE_RING_EVENTS];
+
+    event->begin_ticks = begin != 0 ? begin : end; // 0 if tracing started during the call
+    event->ticks = end;
+    event->pp = (uintptr_t)pp;
+    event->old_pp = (uintptr_t)old_pp;
+    event->info = SF_TRACE_INFO(op, size, align != 0 ? __builtin_ctzll(align) : 0);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Takes the first free slot for the calling thread and arranges for trace_thread_exit to
+ * give it back. Returns 0 if every slot is owned or still being drained.
+ */
+int trace_claim_slot()
+{
+    for (int slot = 0; slot < SF_TRACE_THREADS; slot++)
     {
-        remove_block_from_list();
-        return i;
+        int expected = SF_TRACE_SLOT_FREE;
+
+        if (__atomic_compare_exchange_n(&trace_slot_states[slot], &expected, SF_TRACE_SLOT_OWNED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            trace_slot_threads[slot] = __atomic_fetch_add(&trace_claimed, 1, __ATOMIC_RELAXED);
+            trace_slot = slot + 1;
+            pthread_once(&trace_key_once, trace_create_key);
+            pthread_setspecific(trace_key, &trace_slot);
+            return 1;
+        }
     }
 
-    if (&sf_free_list_heads[NUM_FREE_LISTS - 1] != sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next)
-        curr_block_ptr = sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next;
-    else
-        curr_block_ptr = epilogue_ptr;
+    return 0;
+}
 
-    int available_space = GET_BLOCK_SIZE(&curr_block_ptr->header);
+void trace_create_key()
+{
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
 
-    while (size > available_space)
-    {
-        if (sf_mem_grow() == NULL)
-            return -1;
+/*
+ * Gives an exiting thread's slot back: at once if no trace is running, since the next one
+ * starts its rings empty, or else through the flusher once it has written out the ring.
+ */
+void trace_thread_exit(void *arg)
+{
+    int slot = trace_slot - 1;
 
-        available_space += PAGE_SZ;
-        curr_block_ptr->header += PAGE_SZ;
+    trace_slot = 0; // A later call from another destructor claims a slot afresh
 
-        if (&sf_free_list_heads[NUM_FREE_LISTS - 1] != sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next)
-            add_block_to_list(curr_block_ptr, 1);
+    if (slot < 0 || slot >= SF_TRACE_THREADS)
+        return;
 
-        add_epilogue();
-    }
-    return i;
+    pthread_mutex_lock(&trace_lock);
+    __atomic_store_n(&trace_slot_states[slot], trace_fd >= 0 ? SF_TRACE_SLOT_RETIRED : SF_TRACE_SLOT_FREE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
 }
 
-void remove_block_from_list()
+/*
+ * Maps the ring for the calling thread's slot the first time any thread traces from it; later
+ * owners reuse it. The mapping comes straight from the kernel, so the allocator is not
+ * reentered, and a failed one only leaves the thread out.
+ */
+sf_trace_ring *trace_claim_ring()
 {
-    sf_block *prev_block = curr_block_ptr->body.links.prev;
-    sf_block *next_block = curr_block_ptr->body.links.next;
+    sf_trace_ring *ring = mmap(NULL, sizeof(sf_trace_ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ring == MAP_FAILED)
+    {
+        __atomic_store_n(&trace_slot_states[trace_slot - 1], SF_TRACE_SLOT_FREE, __ATOMIC_RELEASE);
+        trace_slot = SF_TRACE_THREADS + 1;
+        return NULL;
+    }
 
-    next_block->body.links.prev = prev_block;
-    prev_block->body.links.next = next_block;
+    __atomic_store_n(&trace_rings[trace_slot - 1], ring, __ATOMIC_RELEASE); // The flusher reads this without a lock
+    return ring;
 }
 
-void add_block_to_list(sf_block *block_to_add, int is_wilderness)
+void *trace_flush_loop(void *arg)
 {
-    if (is_wilderness)
+    struct timespec pause = {0, SF_TRACE_FLUSH_MS * 1000000L};
+
+    while (__atomic_load_n(&trace_on, __ATOMIC_ACQUIRE))
     {
-        sf_block *tp = curr_block_ptr;
-        curr_block_ptr = block_to_add;
-        get_blocks();
-        curr_block_ptr = tp;
+        if (trace_flush() <= SF_TRACE_RING_EVENTS / 2) // A ring filling faster than that needs no pause
+            nanosleep(&pause, NULL);
+    }
 
-        block_to_add->header = GET_BLOCK_SIZE(&block_to_add->header) + GET_PREV_ALLOC(&block_to_add->header);
-        block_to_add->body.links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-        block_to_add->body.links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = block_to_add;
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = block_to_add;
+    trace_flush();
+    return NULL;
+}
+
+/*
+ * Writes what each ring holds to the trace as one chunk per ring, then frees the space.
+ * Returns the most events any one ring held.
+ */
+uint64_t trace_flush()
+{
+    uint64_t fullest = 0;
+    uint64_t slotless = __atomic_exchange_n(&trace_slotless, 0, __ATOMIC_RELAXED);
 
-        epilogue_ptr->prev_footer = block_to_add->header;
+    if (slotless != 0)
+    {
+        struct sf_trace_chunk chunk = {.thread = SF_TRACE_NO_THREAD, .count = 0, .dropped = slotless};
+        trace_write(trace_fd, &chunk, sizeof(chunk));
     }
-    else
+
+    for (int slot = 0; slot < SF_TRACE_THREADS; slot++)
     {
-        int position = list_position(GET_BLOCK_SIZE(&block_to_add->header));
+        sf_trace_ring *ring = __atomic_load_n(&trace_rings[slot], __ATOMIC_ACQUIRE);
 
-        if (sf_free_list_heads[position].body.links.next != &sf_free_list_heads[position]) // Something already in the list
-        {
-            block_to_add->body.links.next = sf_free_list_heads[position].body.links.next;
-            block_to_add->body.links.prev = &sf_free_list_heads[position];
-            sf_free_list_heads[position].body.links.next = block_to_add;
-        }
-        else // Nothing in the list
+        if (ring == NULL)
+            continue;
+
+        // Read first: once the owner is seen to have exited, head has stopped moving
+        int retired = __atomic_load_n(&trace_slot_states[slot], __ATOMIC_ACQUIRE) == SF_TRACE_SLOT_RETIRED;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+
+        if (head == tail && dropped == 0)
         {
-            block_to_add->body.links.next = &sf_free_list_heads[position];
-            block_to_add->body.links.prev = &sf_free_list_heads[position];
-            sf_free_list_heads[position].body.links.next = block_to_add;
-            sf_free_list_heads[position].body.links.prev = block_to_add;
+            if (retired)
+                __atomic_store_n(&trace_slot_states[slot], SF_TRACE_SLOT_FREE, __ATOMIC_RELEASE);
+            continue;
         }
-    }
 
-    clear_empty_blocks();
-}
+        if (head - tail > fullest)
+            fullest = head - tail;
 
-int remove_block(sf_block *block_to_remove)
-{
-    int position = list_position(GET_BLOCK_SIZE(&block_to_remove->header));
-    sf_block *cursor = sf_free_list_heads[position].body.links.next;
+        struct sf_trace_chunk chunk = {.thread = trace_slot_threads[slot], .count = head - tail, .dropped = dropped};
+        size_t first = tail % SF_TRACE_RING_EVENTS;
+        size_t run = chunk.count < SF_TRACE_RING_EVENTS - first ? chunk.count : SF_TRACE_RING_EVENTS - first;
 
-    while (&cursor->header != (&block_to_remove->header))
-    {
-        cursor = cursor->body.links.next;
+        // Events past the end of the array wrap to its start
+        trace_write(trace_fd, &chunk, sizeof(chunk));
+        trace_write(trace_fd, &ring->events[first], run * sizeof(struct sf_trace_event));
+        trace_write(trace_fd, &ring->events[0], (chunk.count - run) * sizeof(struct sf_trace_event));
 
-        if (cursor == &sf_free_list_heads[position])
-            return 0;
-    }
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
 
-    block_to_remove->body.links.next->body.links.prev = block_to_remove->body.links.prev;
-    block_to_remove->body.links.prev->body.links.next = block_to_remove->body.links.next;
+        if (retired)
+            __atomic_store_n(&trace_slot_states[slot], SF_TRACE_SLOT_FREE, __ATOMIC_RELEASE);
+    }
 
-    return 1;
+    return fullest;
 }
+#endif
 
-int list_position(int num_bytes)
+int trace_write(int fd, const void *buf, size_t len)
 {
-    int upper_limit[] = {1, 2, 3, 5, 8, 13, 21, 34};
-
-    for (int i = 0; i < 8; i++)
+    while (len > 0)
     {
-        if (upper_limit[i] * BLOCK_SZ >= num_bytes)
-            return i;
+        ssize_t written = write(fd, buf, len);
+
+        if (written < 0 && errno != EINTR)
+            return 0;
+
+        if (written > 0)
+        {
+            buf += written;
+            len -= written;
+        }
     }
 
-    return 8;
+    return 1;
 }
 
-int round_to_64(size_t size)
+#if defined(SF_LATENCY) || defined(SF_TRACE)
+/*
+ * When a call begins, read only if an instrument will use it.
+ */
+uint64_t entry_start()
 {
-    if (size % BLOCK_SZ == 0)
-        return size;
-
-    return size + BLOCK_SZ - (size % BLOCK_SZ);
+#ifdef SF_LATENCY
+    return latency_ticks();
+#else
+    return __atomic_load_n(&trace_on, __ATOMIC_RELAXED) ? latency_ticks() : 0;
+#endif
 }
 
-void add_epilogue()
+/*
+ * Hands one call that began at start to whichever instruments are built in.
+ */
+void record_entry(int op, size_t size, size_t align, void *pp, void *old_pp, uint64_t start)
 {
-    epilogue_ptr = (sf_block *)(sf_mem_end() - (2 * sizeof(sf_header))); // Heap end - 8
-    epilogue_ptr->header = 1;
-    epilogue_ptr->prev_footer = curr_block_ptr->header;
+#ifdef SF_LATENCY
+    latency_record(op, size, latency_ticks() - start);
+#endif
+#ifdef SF_TRACE
+    if (__atomic_load_n(&trace_on, __ATOMIC_RELAXED))
+        trace_record(op, op == SF_OP_FREE || op == SF_OP_FREE_SIZED ? 0 : size, align, pp, old_pp, start, latency_ticks());
+#endif
 }
 
-int first_call_to_sf_malloc()
+/*
+ * Traces each block of a batch call that began at start, after record_entry has timed the
+ * call as a whole.
+ */
+void record_batch(int op, size_t size, void **ptrs, size_t n, uint64_t start)
 {
-    if (sf_mem_grow() == NULL) // No memory is left
-        return -1;
+#ifdef SF_TRACE
+    if (!__atomic_load_n(&trace_on, __ATOMIC_RELAXED))
+        return;
 
-    mem_grow_ptr = sf_mem_start();
-    init_lists();
+    uint64_t end = latency_ticks();
 
-    // Insert padding (48) and Prologue (64)
-    prologue_ptr = (sf_block *)(mem_grow_ptr + INITIAL_PADDING); // INITIAL_PADDING  = 48
-    prologue_ptr->header = BLOCK_SZ + 3;                         // 64 for the block size and 3 for prev and current block being allocated
-
-    curr_block_ptr = (sf_block *)(sf_mem_start() + INITIAL_PADDING + BLOCK_SZ);
-    curr_block_ptr->header = PAGE_SZ - (INITIAL_PADDING + BLOCK_SZ + (2 * sizeof(sf_header))) + 2; // PAGE_SZ - sizeof(initial padding) - sizeof(prologue) - sizeof(epilogue)
-    curr_block_ptr->prev_footer = prologue_ptr->header;
+    for (size_t i = 0; i < n; i++)
+        trace_record(op, size, 0, ptrs[i], NULL, start, end);
+#endif
+}
 
-    curr_block_ptr->body.links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-    curr_block_ptr->body.links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = curr_block_ptr;
-    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = curr_block_ptr;
+#undef sf_malloc
+#undef sf_free
+#undef sf_realloc
+#undef sf_memalign
+#undef sf_free_sized
+#undef sf_realloc_in_place
+#undef sf_calloc
+#undef sf_malloc_batch
+#undef sf_free_batch
 
-    add_epilogue();
+void *sf_malloc(size_t size)
+{
+    uint64_t start = entry_start();
+    void *pp = unwrapped_malloc(size);
+    record_entry(SF_OP_MALLOC, size, 0, pp, NULL, start);
 
-    return 1;
+    return pp;
 }
 
-void init_lists()
+void sf_free(void *pp)
 {
-    // If the list is empty, then the fields sf_free_list_heads[i].body.links.next
-    // and sf_free_list_heads[i].body.links.prev both contain &sf_free_list_heads[i]
-
-    for (int i = 0; i < NUM_FREE_LISTS; i++)
-    {
-        sf_free_list_heads[i].body.links.next = &sf_free_list_heads[i];
-        sf_free_list_heads[i].body.links.prev = &sf_free_list_heads[i];
-    }
+#ifdef SF_LATENCY
+    size_t usable = sf_malloc_usable_size(pp); // Before the clock starts; it aborts on what sf_free would
+#else
+    size_t usable = 0;
+#endif
+
+    uint64_t start = entry_start();
+    unwrapped_free(pp);
+    record_entry(SF_OP_FREE, usable, 0, pp, NULL, start);
 }
 
-void count_num_blocks(int pos, int size)
+void *sf_realloc(void *pp, size_t rsize)
 {
-    sf_block *tmp = sf_free_list_heads[pos].body.links.next;
-    int counter = 0;
+    uint64_t start = entry_start();
+    void *new_pp = unwrapped_realloc(pp, rsize);
+    record_entry(SF_OP_REALLOC, rsize, 0, new_pp, pp, start);
 
-    while (tmp != &sf_free_list_heads[pos])
-    {
-        counter += 1;
-        tmp = tmp->body.links.next;
-    }
+    return new_pp;
 }
 
-void clear_empty_blocks()
+void *sf_memalign(size_t size, size_t align)
 {
-    sf_block *tmp;
+    uint64_t start = entry_start();
+    void *pp = unwrapped_memalign(size, align);
+    record_entry(SF_OP_MEMALIGN, size, align, pp, NULL, start);
 
-    for (int i = 0; i < NUM_FREE_LISTS; i++)
-    {
-        tmp = sf_free_list_heads[i].body.links.next;
+    return pp;
+}
 
-        if (tmp != &sf_free_list_heads[i])
-        {
-            if (GET_BLOCK_SIZE(&tmp->header) == 0)
-            {
-                sf_free_list_heads[i].body.links.next = &sf_free_list_heads[i];
-                sf_free_list_heads[i].body.links.prev = &sf_free_list_heads[i];
-            }
-        }
-    }
+void sf_free_sized(void *pp, size_t size)
+{
+    uint64_t start = entry_start();
+    unwrapped_free_sized(pp, size);
+    record_entry(SF_OP_FREE_SIZED, size, 0, pp, NULL, start);
 }
 
-void get_blocks()
+size_t sf_realloc_in_place(void *pp, size_t rsize)
 {
-    prev_block_get_blocks = prologue_ptr;
-    temp_block_get_blocks = prologue_ptr;
+    uint64_t start = entry_start();
+    size_t usable = unwrapped_realloc_in_place(pp, rsize);
+    record_entry(SF_OP_REALLOC_IN_PLACE, rsize, 0, usable >= rsize ? pp : NULL, pp, start);
 
-    do
-    {
-        if (temp_block_get_blocks == epilogue_ptr)
-            break;
+    return usable;
+}
 
-        prev_block_get_blocks = temp_block_get_blocks;
-        temp_block_get_blocks = GET_NEXT_BLOCK(temp_block_get_blocks);
-    } while ((&((temp_block_get_blocks))->header) != &(curr_block_ptr->header));
+void *sf_calloc(size_t nmemb, size_t size)
+{
+    uint64_t start = entry_start();
+    void *pp = unwrapped_calloc(nmemb, size);
+    record_entry(SF_OP_CALLOC, pp != NULL ? nmemb * size : 0, 0, pp, NULL, start);
 
-    next_block_get_blocks = GET_NEXT_BLOCK(curr_block_ptr);
+    return pp;
 }
 
-int is_power_of_2(int value)
+// A batch is one call, so one latency sample in the class of its blocks, but an event per block
+size_t sf_malloc_batch(size_t size, size_t n, void **out)
 {
+    uint64_t start = entry_start();
+    size_t done = unwrapped_malloc_batch(size, n, out);
+#ifdef SF_LATENCY
+    latency_record(SF_OP_MALLOC_BATCH, size, latency_ticks() - start);
+#endif
+    record_batch(SF_OP_MALLOC_BATCH, size, out, done, start);
+
+    return done;
+}
 
-    if (value == 0 || value == 1)
-        return 1;
-    
-    int old_value = value;
-    while (value > 1)
-    {
-        old_value = value;
-        value /= 2;
-        if (value * 2 != old_value)
-            return 0;
-    }
-    if (value != 1)
-        return 0;
-    return value;
-}
\ No newline at end of file
+void sf_free_batch(void **ptrs, size_t n)
+{
+#ifdef SF_LATENCY
+    size_t usable = n != 0 ? sf_malloc_usable_size(ptrs[0]) : 0; // The first block stands for the batch
+#endif
+
+    uint64_t start = entry_start();
+    unwrapped_free_batch(ptrs, n); // Sorts ptrs, but leaves every pointer in it
+#ifdef SF_LATENCY
+    latency_record(SF_OP_FREE_BATCH, usable, latency_ticks() - start);
+#endif
+    record_batch(SF_OP_FREE_BATCH, 0, ptrs, n, start);
+}
+#endif
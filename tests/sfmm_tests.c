@@ -1,8 +1,14 @@
 #include <criterion/criterion.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "debug.h"
 #include "sfmm.h"
+#include "sfmm_ext.h"
 #define TEST_TIMEOUT 15
 
 void assert_free_block_count(size_t size, int count);
@@ -205,3 +211,850 @@ Test(sf_memsuite_student, realloc_smaller_block_free_block, .init = sf_mem_init,
 //STUDENT UNIT TESTS SHOULD BE WRITTEN BELOW
 //DO NOT DELETE THESE COMMENTS
 //############################################
+
+Test(sf_memsuite_student, coalesce_in_long_class8_list, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	// Alternate class-8 blocks (2240 bytes, the smallest size above 34M) with minimum-size
+	// separators until the heap is full, then free every big block so the class-8 list is
+	// as long as the heap allows.
+	size_t big_sz = 35 * 64 - sizeof(sf_header);
+	void *big[32];
+	void *small[32];
+	int n = 0;
+
+	while (n < 32 && (big[n] = sf_malloc(big_sz)) != NULL) {
+		small[n] = sf_malloc(1);
+		cr_assert_not_null(small[n], "small[%d] is NULL!", n);
+		n++;
+	}
+	cr_assert(n > 20, "Only %d big blocks fit in the heap", n);
+	sf_errno = 0;
+
+	for (int i = 0; i < n; i++)
+		sf_free(big[i]);
+	assert_free_list_size(NUM_FREE_LISTS-2, n);
+
+	// The oldest big blocks sit at the tail of the list; freeing the separator between
+	// them has to unlink both neighbours from deep inside it.
+	sf_free(small[0]);
+	assert_free_list_size(NUM_FREE_LISTS-2, n - 1);
+	assert_free_block_count(2 * 2240 + 64, 1);
+
+	// Same thing in the middle of the list.
+	sf_free(small[n / 2]);
+	assert_free_list_size(NUM_FREE_LISTS-2, n - 2);
+	assert_free_block_count(2 * 2240 + 64, 2);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, tcache_reuses_freed_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 8), "sf_mallopt rejected a valid cache size");
+
+	void *x = sf_malloc(8);
+	cr_assert_not_null(x, "x is NULL!");
+
+	// The first miss refills the bin with half a cache worth of 64-byte blocks.
+	struct sf_tcache_stats stats;
+	sf_tcache_stats(&stats);
+	cr_assert_eq(stats.malloc_misses, 1, "Expected one cache miss (found=%lu)", stats.malloc_misses);
+	cr_assert_eq(stats.refills, 1, "Expected one refill (found=%lu)", stats.refills);
+
+	// A cached block stays allocated in the heap and never shows up in the free lists.
+	sf_free(x);
+	assert_free_list_size(0, 0);
+	assert_free_list_size(NUM_FREE_LISTS-1, 1);
+
+	void *y = sf_malloc(20);
+	cr_assert_eq(x, y, "Cached block was not reused (x=%p, y=%p)", x, y);
+	sf_tcache_stats(&stats);
+	cr_assert_eq(stats.malloc_hits, 1, "Expected one cache hit (found=%lu)", stats.malloc_hits);
+	cr_assert_eq(stats.free_hits, 1, "Expected one cached free (found=%lu)", stats.free_hits);
+
+	// Turning the cache off returns everything to the heap, where it coalesces into the wilderness.
+	sf_free(y);
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 0), "sf_mallopt rejected a valid cache size");
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3968, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, tcache_drops_blocks_of_old_heap, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 8), "sf_mallopt rejected a valid cache size");
+	sf_malloc(8); // Leaves the rest of the refill in the cache
+
+	// The cached blocks went with the old heap, so the next request lays out the new one.
+	sf_mem_fini();
+	sf_mem_init();
+	void *x = sf_malloc(8);
+	cr_assert(x >= sf_mem_start() && x < sf_mem_end(), "x (%p) is not in the new heap", x);
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 0), "sf_mallopt rejected a valid cache size");
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, tcache_flushes_full_bin, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	void *p[6];
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 4), "sf_mallopt rejected a valid cache size");
+
+	for (int i = 0; i < 6; i++)
+		p[i] = sf_malloc(100);
+
+	// The bin holds 4 blocks, so the fifth free flushes the two most recent ones to the heap.
+	for (int i = 0; i < 6; i++)
+		sf_free(p[i]);
+
+	struct sf_tcache_stats stats;
+	sf_tcache_stats(&stats);
+	cr_assert_eq(stats.free_misses, 1, "Expected one full-bin free (found=%lu)", stats.free_misses);
+	cr_assert_eq(stats.flushes, 1, "Expected one flush (found=%lu)", stats.flushes);
+	assert_free_block_count(256, 1);
+	cr_assert(!sf_mallopt(SF_OPT_TCACHE_COUNT, SF_TCACHE_MAX_COUNT + 1), "sf_mallopt accepted an oversized cache");
+}
+
+static void *cache_in_thread(void *arg) {
+	sf_free(sf_malloc((size_t)arg)); // The refill leaves the rest of a half bin in the cache
+	return NULL;
+}
+
+Test(sf_memsuite_student, tcache_returns_blocks_at_thread_exit, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MULTITHREADED, 1), "sf_mallopt rejected multithreaded mode");
+	cr_assert(sf_mallopt(SF_OPT_TCACHE_COUNT, 16), "sf_mallopt rejected a valid cache size");
+
+	for (int t = 0; t < 40; t++) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, cache_in_thread, (void *)8);
+		pthread_join(thread, NULL);
+	}
+
+	// Each thread's cache went back to the heap as it exited, so nothing is left allocated.
+	struct sf_stats stats;
+	sf_mallopt(SF_OPT_TCACHE_COUNT, 0);
+	sf_mallopt(SF_OPT_MULTITHREADED, 0);
+	sf_get_stats(&stats);
+	cr_assert_eq(stats.live_bytes, 0, "%zu bytes were stranded in exited threads' caches", stats.live_bytes);
+	cr_assert_eq(stats.heap_bytes, PAGE_SZ, "The heap grew to %zu bytes", stats.heap_bytes);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+#define STRESS_THREADS 4
+#define STRESS_SLOTS 16
+#define STRESS_ROUNDS 20000
+
+/*
+ * Each thread churns its own slots with mixed sizes, stamping every payload with a pattern
+ * that would be torn if two threads were ever handed overlapping blocks.
+ */
+static void *stress_worker(void *arg) {
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	unsigned char *slots[STRESS_SLOTS] = {NULL};
+	size_t sizes[STRESS_SLOTS] = {0};
+	long bad = 0;
+
+	for (int round = 0; round < STRESS_ROUNDS; round++) {
+		seed = seed * 1103515245 + 12345;
+		int i = (seed >> 16) % STRESS_SLOTS;
+
+		if (slots[i] != NULL) {
+			for (size_t j = 0; j < sizes[i]; j++)
+				bad += slots[i][j] != (unsigned char)(uintptr_t)arg;
+			sf_free(slots[i]);
+			slots[i] = NULL;
+		} else {
+			sizes[i] = 1 + (seed >> 20) % 300;
+			slots[i] = sf_malloc(sizes[i]);
+			if (slots[i] == NULL)
+				return (void *)-1;
+			memset(slots[i], (unsigned char)(uintptr_t)arg, sizes[i]);
+		}
+	}
+
+	for (int i = 0; i < STRESS_SLOTS; i++)
+		if (slots[i] != NULL)
+			sf_free(slots[i]);
+
+	return (void *)bad;
+}
+
+Test(sf_memsuite_student, multithreaded_stress, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	pthread_t threads[STRESS_THREADS];
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MULTITHREADED, 1), "sf_mallopt rejected multithreaded mode");
+
+	for (long t = 0; t < STRESS_THREADS; t++)
+		cr_assert_eq(pthread_create(&threads[t], NULL, stress_worker, (void *)(t + 1)), 0, "pthread_create failed");
+
+	for (int t = 0; t < STRESS_THREADS; t++) {
+		void *bad;
+		pthread_join(threads[t], &bad);
+		cr_assert_eq(bad, NULL, "Thread %d saw a corrupted or failed allocation", t);
+	}
+
+	// With everything freed, the whole heap coalesces back into the wilderness.
+	sf_mallopt(SF_OPT_MULTITHREADED, 0);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+static int neighbour_done;
+
+/*
+ * Reuses the block in front of another thread's block, filling it to its last row, which is
+ * the neighbour's prev_footer while it is allocated.
+ */
+static void *neighbour_worker(void *arg) {
+	for (int round = 0; round < STRESS_ROUNDS * 5; round++) {
+		void *x = sf_malloc(56);
+		memset(x, 0xff, 56);
+		sf_free(x);
+	}
+	__atomic_store_n(&neighbour_done, 1, __ATOMIC_RELEASE);
+	return arg;
+}
+
+Test(sf_memsuite_student, usable_size_beside_busy_neighbour, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	pthread_t thread;
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MULTITHREADED, 1), "sf_mallopt rejected multithreaded mode");
+	void *x = sf_malloc(56);
+	void *y = sf_malloc(100);
+	sf_free(x);
+
+	// The neighbour's malloc and free move y's prev bits under the lock; the size must not mind.
+	pthread_create(&thread, NULL, neighbour_worker, NULL);
+	while (!__atomic_load_n(&neighbour_done, __ATOMIC_ACQUIRE))
+		cr_assert_eq(sf_malloc_usable_size(y), 120, "Wrong usable size");
+	pthread_join(thread, NULL);
+
+	sf_free(y);
+	sf_mallopt(SF_OPT_MULTITHREADED, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+static void *malloc_in_thread(void *arg) {
+	return sf_malloc((size_t)arg);
+}
+
+Test(sf_memsuite_student, arena_free_returns_to_owner, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	pthread_t thread;
+	void *remote;
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MULTITHREADED, 1), "sf_mallopt rejected multithreaded mode");
+	cr_assert(sf_mallopt(SF_OPT_ARENA_COUNT, 2), "sf_mallopt rejected two arenas");
+	cr_assert(!sf_mallopt(SF_OPT_ARENA_COUNT, SF_MAX_ARENAS + 1), "sf_mallopt accepted too many arenas");
+
+	// Round-robin: this thread gets the sfutil heap, the next one gets a secondary arena.
+	void *local = sf_malloc(100);
+	cr_assert_not_null(local, "local is NULL!");
+	cr_assert(local >= sf_mem_start() && local < sf_mem_end(), "First thread was not given arena 0");
+
+	pthread_create(&thread, NULL, malloc_in_thread, (void *)100);
+	pthread_join(thread, &remote);
+	cr_assert_not_null(remote, "remote is NULL!");
+	cr_assert(remote < sf_mem_start() || remote >= sf_mem_end(), "Second thread was not given its own arena");
+
+	// Freeing the other arena's block from here must not touch the sfutil heap's lists.
+	sf_free(remote);
+	assert_free_block_count(0, 1);
+	sf_free(local);
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3968, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, fork_handlers_leave_locks_usable, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	int status;
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MULTITHREADED, 1), "sf_mallopt rejected multithreaded mode");
+	cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 8192), "sf_mallopt rejected a threshold");
+	cr_assert_eq(pthread_atfork(sf_fork_prepare, sf_fork_parent, sf_fork_child), 0, "pthread_atfork failed");
+	void *x = sf_malloc(100);
+
+	// The child allocates from the heap and the large-object table, each behind a lock.
+	pid_t pid = fork();
+	if (pid == 0) {
+		void *y = sf_malloc(100), *z = sf_malloc(10000);
+		sf_free(x);
+		sf_free(y);
+		sf_free(z);
+		_exit(y != NULL && z != NULL ? 0 : 1);
+	}
+
+	cr_assert_eq(waitpid(pid, &status, 0), pid, "waitpid failed");
+	cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "The child could not allocate");
+	sf_free(x);
+	sf_free(sf_malloc(10000));
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+	sf_mallopt(SF_OPT_MULTITHREADED, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, slab_packs_small_objects, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_SLAB, 1), "sf_mallopt rejected slabs");
+
+	// Objects of the same class sit back to back after the slab header, with no header of their own.
+	char *x = sf_malloc(1);
+	char *y = sf_malloc(8);
+	cr_assert_not_null(x, "x is NULL!");
+	cr_assert_eq(y, x + 8, "Objects are not packed (x=%p, y=%p)", x, y);
+	cr_assert_eq((uintptr_t)x % PAGE_SZ, 128, "First object is not right after the slab header");
+
+	// A different class gets a slab of its own.
+	char *z = sf_malloc(40);
+	cr_assert_eq((uintptr_t)z % PAGE_SZ, 128, "40-byte object is not in a fresh slab");
+	cr_assert_neq((uintptr_t)z / PAGE_SZ, (uintptr_t)x / PAGE_SZ, "40-byte object shares the 8-byte slab");
+
+	// The last slab of a class stays around once empty, so its first object is handed out again.
+	sf_free(y);
+	sf_free(x);
+	sf_free(z);
+	cr_assert_eq(sf_malloc(5), x, "Empty slab was not reused");
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, slab_free_interior_pointer, .init = sf_mem_init, .fini = sf_mem_fini, .signal = SIGABRT, .timeout = TEST_TIMEOUT) {
+	sf_mallopt(SF_OPT_SLAB, 1);
+	char *x = sf_malloc(16);
+	sf_free(x + 8);
+}
+
+Test(sf_memsuite_student, realloc_grows_into_free_neighbours, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *a = sf_malloc(100);
+	char *x = sf_malloc(100);
+	char *b = sf_malloc(500);
+	/* char *c = */ sf_malloc(10);
+	memset(x, 'x', 100);
+
+	// Forward: x absorbs the 512-byte block freed after it and keeps its address.
+	sf_free(b);
+	char *y = sf_realloc(x, 400);
+	cr_assert_eq(y, x, "Realloc did not grow into the free successor");
+	cr_assert_eq((((sf_block *)(y - 16))->header & BLOCK_SIZE_MASK), 448, "Grown block has the wrong size");
+	assert_free_block_count(192, 1);
+
+	// Backward: the successor alone is too small, but with a it fits, so the payload slides down to a.
+	sf_free(a);
+	char *z = sf_realloc(y, 700);
+	cr_assert_eq(z, a, "Realloc did not grow into the free predecessor");
+	for (int i = 0; i < 100; i++)
+		cr_assert_eq(z[i], 'x', "Payload was not moved with the block (byte %d)", i);
+	cr_assert_eq((((sf_block *)(z - 16))->header & BLOCK_SIZE_MASK), 768, "Moved block has the wrong size");
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, realloc_in_place_at_top, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_malloc(200);
+
+	// The block borders the wilderness, so it can grow past the first page without moving.
+	size_t usable = sf_realloc_in_place(x, 5000);
+	cr_assert_eq(usable, 5048, "Wrong usable size after growing in place (found=%lu)", usable);
+	cr_assert_eq(sf_mem_end() - sf_mem_start(), 2 * PAGE_SZ, "Heap did not grow by exactly one page");
+	assert_free_block_count(0, 1);
+
+	// A request that cannot be met leaves the block as it was.
+	usable = sf_realloc_in_place(x, 100 * PAGE_SZ);
+	cr_assert_eq(usable, 5048, "Failed in-place growth changed the block (found=%lu)", usable);
+
+	// Shrinking splits the tail off, still without moving.
+	usable = sf_realloc_in_place(x, 100);
+	cr_assert_eq(usable, 120, "Wrong usable size after shrinking in place (found=%lu)", usable);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, mmap_large_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 32 * 1024), "sf_mallopt rejected the threshold");
+
+	// Bigger than the whole sfutil heap, so only a mapping of its own can hold it.
+	char *x = sf_malloc(PAGE_SZ << 6);
+	cr_assert_not_null(x, "x is NULL!");
+	cr_assert_eq((uintptr_t)x % 64, 0, "Large payload is not 64-byte aligned");
+	cr_assert_eq(sf_mem_start(), sf_mem_end(), "Large request touched the heap");
+	memset(x, 'x', PAGE_SZ << 6);
+
+	// mremap keeps every byte, wherever the mapping ends up.
+	char *y = sf_realloc(x, PAGE_SZ << 8);
+	cr_assert_not_null(y, "y is NULL!");
+	for (int i = 0; i < PAGE_SZ << 6; i += PAGE_SZ)
+		cr_assert_eq(y[i], 'x', "Payload was lost by mremap (byte %d)", i);
+
+	// Small requests still come from the heap, and freeing the large block leaves it alone.
+	void *z = sf_malloc(100);
+	sf_free(y);
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3840, 1);
+	sf_free(z);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, many_large_blocks, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	static void *blocks[1500];
+	cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 4096), "sf_mallopt rejected the threshold");
+
+	// More live mappings than the table starts with, then enough churn to fill it with tombstones.
+	for (int i = 0; i < 1500; i++)
+		cr_assert_not_null(blocks[i] = sf_malloc(8192), "Large block %d is NULL", i);
+	for (int i = 0; i < 1500; i++)
+		sf_free(blocks[i]);
+	for (int i = 0; i < 5000; i++)
+		sf_free(sf_malloc(8192));
+
+	// None of it fell back to the heap.
+	cr_assert_eq(sf_mem_start(), sf_mem_end(), "A large request fell back to the heap");
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, realloc_across_mmap_threshold, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_malloc(30000);
+	cr_assert_not_null(x, "x is NULL!");
+	memset(x, 'x', 30000);
+	cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 4096), "sf_mallopt rejected the threshold");
+
+	// Shrinking a heap block to a size past the threshold splits it where it is.
+	char *y = sf_realloc(x, 4096);
+	cr_assert_eq(y, x, "Shrinking realloc moved the block");
+	for (int i = 0; i < 4096; i++)
+		cr_assert_eq(y[i], 'x', "Payload was lost by the shrink (byte %d)", i);
+
+	// Growing a small heap block past the threshold moves it to a mapping, copying only what it held.
+	char *z = sf_malloc(1000);
+	memset(z, 'z', 1000);
+	char *w = sf_realloc(z, 8192);
+	cr_assert_not_null(w, "w is NULL!");
+	cr_assert(w < (char *)sf_mem_start() || w >= (char *)sf_mem_end(), "Growing realloc stayed in the heap");
+	for (int i = 0; i < 1000; i++)
+		cr_assert_eq(w[i], 'z', "Payload was lost by the move (byte %d)", i);
+
+	sf_free(w);
+	sf_free(y);
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, geometric_growth, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_GROWTH_POLICY, SF_GROWTH_GEOMETRIC), "sf_mallopt rejected geometric growth");
+
+	// The first growth is a single page and leaves exactly one more 4032-byte block of room.
+	sf_malloc(4000);
+	sf_malloc(4000);
+	cr_assert_eq(sf_mem_end() - sf_mem_start(), 2 * PAGE_SZ, "Heap did not grow by one page");
+	assert_free_block_count(0, 0);
+
+	// The next step is two pages, although one would do.
+	sf_malloc(4000);
+	cr_assert_eq(sf_mem_end() - sf_mem_start(), 4 * PAGE_SZ, "Heap did not grow by two pages");
+	assert_free_block_count(0, 1);
+	assert_free_block_count(4160, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, malloc_trim_releases_wilderness, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *keep = sf_malloc(100);
+	char *x = sf_malloc(40000);
+	memset(x, 'x', 40000);
+	sf_free(x);
+
+	// The first trim releases the wilderness tail; a second has nothing left to give back.
+	cr_assert_eq(sf_malloc_trim(0), 1, "sf_malloc_trim released nothing");
+	cr_assert_eq(sf_malloc_trim(0), 0, "sf_malloc_trim released the same pages twice");
+
+	// The wilderness keeps its size and links, and its released pages come back zeroed.
+	assert_free_block_count(0, 1);
+	char *y = sf_malloc(40000);
+	cr_assert_eq(y, x, "Wilderness was not reused in place");
+	cr_assert_eq(y[20000], 0, "Released page was not zeroed");
+	memset(y, 'y', 40000);
+	sf_free(y);
+	sf_free(keep);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, purge_free_block_on_free, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_PURGE_DECAY, 0), "sf_mallopt rejected purging on free");
+	void *a = sf_malloc(100);
+	char *b = sf_malloc(20000);
+	void *c = sf_malloc(100);
+	memset(b, 'b', 20000);
+	sf_free(b);
+
+	// The purged block keeps its place in the last size class, with its tags intact.
+	assert_free_list_size(NUM_FREE_LISTS - 2, 1);
+	assert_free_block_count(20032, 1);
+
+	char *d = sf_malloc(20000);
+	cr_assert_eq(d, b, "Purged block was not reused in place");
+	cr_assert_eq(d[10000], 0, "Interior page was not purged");
+	memset(d, 'd', 20000);
+	sf_free(d);
+	sf_free(a);
+	sf_free(c);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, purge_free_block_after_decay, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *small[64];
+	cr_assert(sf_mallopt(SF_OPT_PURGE_DECAY, 1), "sf_mallopt rejected a decay time");
+	void *a = sf_malloc(100);
+	char *b = sf_malloc(20000);
+	void *c = sf_malloc(100); // Keeps the small blocks from coalescing with b, which would restamp it
+	for (int i = 0; i < 64; i++)
+		small[i] = sf_malloc(100);
+	memset(b, 'b', 20000);
+	sf_free(b);
+	cr_assert_eq(b[10000], 'b', "Block was purged before its decay time");
+
+	// Let the block age past the decay time, then free enough blocks to trigger a scan.
+	clock_t start = clock();
+	while (clock() - start < CLOCKS_PER_SEC / 50)
+		;
+	for (int i = 0; i < 64; i++)
+		sf_free(small[i]);
+
+	char *d = sf_malloc(20000);
+	cr_assert_eq(d, b, "Purged block was not reused in place");
+	cr_assert_eq(d[10000], 0, "Interior page was not purged after the decay time");
+	sf_free(d);
+	sf_free(a);
+	sf_free(c);
+	assert_free_block_count(0, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, best_fit_takes_smallest_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_FIT_POLICY, SF_FIT_BEST), "sf_mallopt rejected best fit");
+	void *a = sf_malloc(1200);
+	sf_malloc(100);
+	void *b = sf_malloc(900);
+	sf_malloc(100);
+
+	// Both blocks share a size class; a, freed last, sits at the front of it.
+	sf_free(b);
+	sf_free(a);
+	void *c = sf_malloc(850);
+	cr_assert_eq(c, b, "Best fit did not take the smaller block");
+	assert_free_block_count(1216, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, address_ordered_fit_takes_lowest_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert(sf_mallopt(SF_OPT_FIT_POLICY, SF_FIT_ADDRESS), "sf_mallopt rejected address-ordered fit");
+	void *a = sf_malloc(900);
+	sf_malloc(100);
+	void *b = sf_malloc(900);
+	sf_malloc(100);
+
+	// b, freed last, would be taken first in LIFO order.
+	sf_free(a);
+	sf_free(b);
+	void *c = sf_malloc(900);
+	cr_assert_eq(c, a, "Address-ordered fit did not take the lowest block");
+	cr_assert_eq(sf_malloc(900), b, "Address-ordered fit did not take the remaining block");
+	cr_assert(!sf_mallopt(SF_OPT_FIT_POLICY, 4), "sf_mallopt accepted an unknown policy");
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, malloc_batch_carves_one_region, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *blocks[10];
+	cr_assert_eq(sf_malloc_batch(100, 10, blocks), 10, "sf_malloc_batch came back short");
+
+	// The blocks sit back to back at the bottom of the heap, and the rest is still the wilderness.
+	for (int i = 1; i < 10; i++)
+		cr_assert_eq((char *)blocks[i] - (char *)blocks[i - 1], 128, "Block %d is not next to block %d", i, i - 1);
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3968 - 1280, 1);
+
+	// Freed out of order, the run still folds back into a single wilderness.
+	void *shuffled[10] = {blocks[7], blocks[2], blocks[9], blocks[0], blocks[5],
+			      blocks[1], blocks[8], blocks[3], blocks[6], blocks[4]};
+	sf_free_batch(shuffled, 10);
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3968, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, malloc_batch_runs_out_of_memory, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *blocks[80];
+
+	// 80 blocks of 1 KiB cannot fit in sfutil's 16 pages, but as many as do are handed out.
+	size_t made = sf_malloc_batch(1000, 80, blocks);
+	cr_assert(made > 50 && made < 80, "sf_malloc_batch made %zu blocks", made);
+	cr_assert(sf_errno == ENOMEM, "sf_errno is not ENOMEM");
+
+	// Reversed, so the batch has to be sorted before its neighbours can be merged.
+	for (size_t i = 0; i < made / 2; i++) {
+		void *tmp = blocks[i];
+		blocks[i] = blocks[made - 1 - i];
+		blocks[made - 1 - i] = tmp;
+	}
+	sf_free_batch(blocks, made);
+	assert_free_block_count(0, 1);
+}
+
+Test(sf_memsuite_student, calloc_zeroes_recycled_memory, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_malloc(3000);
+	memset(x, 0xff, 3000);
+	sf_free(x);
+
+	char *y = sf_calloc(30, 100);
+	cr_assert_eq(y, x, "sf_calloc did not reuse the freed block");
+	for (int i = 0; i < 3000; i++)
+		cr_assert_eq(y[i], 0, "Byte %d was not zeroed", i);
+
+	// Past what was ever handed out, the tags of the wilderness and epilogue must not leak through.
+	char *z = sf_calloc(1, 20000);
+	for (int i = 0; i < 20000; i++)
+		cr_assert_eq(z[i], 0, "Byte %d of the fresh block was not zeroed", i);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, calloc_after_trim, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *keep = sf_malloc(100);
+	char *x = sf_malloc(30000);
+	memset(x, 0xff, 30000);
+	sf_free(x);
+	sf_malloc_trim(0);
+
+	// The trimmed wilderness is carved twice, so the second block starts on released pages.
+	char *y = sf_calloc(100, 100);
+	char *z = sf_calloc(100, 190);
+	for (int i = 0; i < 10000; i++)
+		cr_assert_eq(y[i], 0, "Byte %d of the first block was not zeroed", i);
+	for (int i = 0; i < 19000; i++)
+		cr_assert_eq(z[i], 0, "Byte %d of the second block was not zeroed", i);
+	sf_free(keep);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, calloc_overflow, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	cr_assert_null(sf_calloc(SIZE_MAX / 2, 3), "sf_calloc did not catch the overflow");
+	cr_assert(sf_errno == ENOMEM, "sf_errno is not ENOMEM");
+	sf_errno = 0;
+	cr_assert_null(sf_calloc(0, 100), "sf_calloc of nothing did not return NULL");
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, usable_size_and_sized_free, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_malloc(100);
+	size_t usable = sf_malloc_usable_size(x);
+	cr_assert_eq(usable, 120, "Usable size of a 128-byte block is %zu", usable);
+	memset(x, 'x', usable);
+
+	void *y = sf_malloc(1000);
+	cr_assert_eq(sf_malloc_usable_size(NULL), 0, "Usable size of NULL is not 0");
+
+	// The whole usable size is a valid size to free with, as is the size asked for.
+	sf_free_sized(x, usable);
+	sf_free_sized(y, 1000);
+	assert_free_block_count(0, 1);
+	assert_free_block_count(3968, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, sized_free_wrong_size, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *x = sf_malloc(1000);
+	sf_malloc(100);
+
+	// A size that does not match the header falls back to sf_free, which still frees the block.
+	sf_free_sized(x, 200);
+	assert_free_block_count(1024, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, sized_free_slab_object, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	sf_mallopt(SF_OPT_SLAB, 1);
+	void *x = sf_malloc(16);
+	sf_mallopt(SF_OPT_SLAB, 0);
+
+	// With slabs off a small size takes the header compare, but x still goes back to its slab.
+	void *y = sf_malloc(16);
+	sf_free_sized(y, 16);
+	sf_free_sized(x, 16);
+	sf_mallopt(SF_OPT_SLAB, 1);
+	cr_assert_eq(sf_malloc(16), x, "x did not go back to its slab");
+	sf_mallopt(SF_OPT_SLAB, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, sized_free_twice, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT, .signal = SIGABRT) {
+	sf_errno = 0;
+	void *x = sf_malloc(1000);
+	sf_malloc(100);
+	sf_free_sized(x, 1000);
+	sf_free_sized(x, 1000);
+}
+
+Test(sf_memsuite_student, memalign_uses_aligned_position, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_malloc(1000);
+	sf_malloc(100);
+	sf_free(x);
+
+	// The freed 1024-byte block has a 512-aligned payload position with room for the request.
+	size_t lead = (512 - (uintptr_t)x % 512) % 512;
+	char *y = sf_memalign(500, 512);
+	cr_assert((uintptr_t)y % 512 == 0, "y is not aligned to 512");
+	cr_assert_eq(y, x + lead, "y was not placed in the freed block");
+
+	// The lead in front of it and the tail behind it stay free.
+	if (lead != 0)
+		assert_free_block_count(lead, 1);
+	assert_free_block_count(1024 - 512 - lead, 1);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, memalign_past_a_page, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	char *x = sf_memalign(100, 16384);
+	cr_assert_not_null(x, "x is NULL!");
+	cr_assert((uintptr_t)x % 16384 == 0, "x is not aligned to 16384");
+	cr_assert(x < (char *)sf_mem_start() || x >= (char *)sf_mem_end(), "x was carved out of the heap");
+	memset(x, 'x', 100);
+
+	cr_assert(sf_malloc_usable_size(x) >= 100, "Usable size is smaller than the request");
+	sf_free(x);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, memalign_wide_non_power_of_2, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+
+	// Both alignments are powers of two in their low 32 bits, which must not be all that is checked.
+	cr_assert_null(sf_memalign(100, (1UL << 32) + 4096), "An alignment of 2^32 + 4096 was accepted");
+	cr_assert_eq(sf_errno, EINVAL, "sf_errno is not EINVAL");
+	sf_errno = 0;
+	cr_assert_null(sf_memalign(100, (1UL << 32) + 64), "An alignment of 2^32 + 64 was accepted");
+	cr_assert_eq(sf_errno, EINVAL, "sf_errno is not EINVAL");
+}
+
+Test(sf_memsuite_student, stats_track_blocks, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	void *x = sf_malloc(100);
+	void *y = sf_malloc(100);
+	sf_malloc(100);
+	sf_free(x);
+
+	struct sf_stats stats;
+	sf_get_stats(&stats);
+
+	// Three 128-byte blocks were carved off the wilderness and one came back.
+	cr_assert_eq(stats.classes[1].mallocs, 3, "Wrong malloc count (%zu)", stats.classes[1].mallocs);
+	cr_assert_eq(stats.classes[1].frees, 1, "Wrong free count (%zu)", stats.classes[1].frees);
+	cr_assert_eq(stats.classes[NUM_FREE_LISTS - 1].splits, 3, "Wrong wilderness split count");
+	cr_assert_eq(stats.classes[1].free_blocks, 1, "Wrong free block count");
+	cr_assert_eq(stats.classes[1].free_bytes, 128, "Wrong free bytes in class 1");
+	cr_assert_eq(stats.heap_bytes, PAGE_SZ, "Wrong heap size (%zu)", stats.heap_bytes);
+	cr_assert_eq(stats.peak_heap_bytes, PAGE_SZ, "Wrong peak heap size");
+	cr_assert_eq(stats.grow_calls, 1, "Wrong grow count (%zu)", stats.grow_calls);
+	cr_assert_eq(stats.live_bytes, 256, "Wrong live bytes (%zu)", stats.live_bytes);
+	cr_assert_eq(stats.free_bytes, 128 + 3584, "Wrong free bytes (%zu)", stats.free_bytes);
+	double fragmentation = 1.0 - 3584.0 / 3712.0;
+	cr_assert(stats.fragmentation > fragmentation - 1e-9 && stats.fragmentation < fragmentation + 1e-9,
+		  "Wrong fragmentation (%f)", stats.fragmentation);
+
+	// y merges with the free block in front of it into a 256-byte block, in the (3M, 5M] list.
+	sf_free(y);
+	sf_get_stats(&stats);
+	cr_assert_eq(stats.classes[3].coalesces, 1, "Wrong coalesce count");
+	cr_assert_eq(stats.classes[3].free_bytes, 256, "Wrong free bytes in class 3");
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, latency_percentiles, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	static struct sf_latency latency;
+
+	// Without -DSF_LATENCY nothing is recorded, so a merge adds nothing.
+	sf_free(sf_malloc(100));
+	sf_latency_merge(&latency);
+	for (int op = 0; op < SF_OP_COUNT; op++)
+		for (int c = 0; c < SF_STATS_CLASSES; c++)
+			for (int i = 0; i < SF_LATENCY_BUCKETS; i++)
+				cr_assert_eq(latency.ops[op][c].counts[i], 0, "A sample was recorded");
+
+	// 995 fast samples and 5 slow ones: only p999 reaches the slow bucket.
+	struct sf_latency_histogram *histogram = &latency.ops[SF_OP_MALLOC][0];
+	histogram->counts[10] = 995;
+	histogram->counts[100] = 5;
+
+	double p50 = sf_latency_percentile(histogram, 0.5);
+	double p99 = sf_latency_percentile(histogram, 0.99);
+	double p999 = sf_latency_percentile(histogram, 0.999);
+	cr_assert(p50 > 0 && p50 == p99, "p50 (%f) and p99 (%f) should share a bucket", p50, p99);
+	cr_assert(p999 > 1000 * p99, "p999 (%f) is not in the slow bucket", p999);
+	cr_assert_eq(sf_latency_percentile(&latency.ops[SF_OP_FREE][0], 0.5), 0, "An empty histogram has a percentile");
+}
+
+Test(sf_memsuite_student, trace_needs_build_flag, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+
+	// Without -DSF_TRACE there is nothing to record, so no trace starts.
+	cr_assert_eq(sf_trace_start("/dev/null"), 0, "A trace started without -DSF_TRACE");
+	sf_free(sf_malloc(100));
+	sf_trace_stop();
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, realloc_in_place_large_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 8192);
+	char *x = sf_malloc(10000);
+	memset(x, 'x', 10000);
+
+	// A mapping shrinks where it is, and grows only if the pages after it are free.
+	size_t usable = sf_realloc_in_place(x, 100);
+	cr_assert_eq(usable, PAGE_SZ - 64, "Usable size after the shrink is %zu", usable);
+	usable = sf_realloc_in_place(x, 20000);
+	cr_assert(usable >= 20000 || usable == PAGE_SZ - 64, "Usable size after the grow is %zu", usable);
+	cr_assert_eq(sf_malloc_usable_size(x), usable, "The table disagrees with the usable size");
+	for (int i = 0; i < 100; i++)
+		cr_assert_eq(x[i], 'x', "Byte %d changed", i);
+
+	sf_free(x);
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sf_memsuite_student, owns_its_blocks_only, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+	sf_errno = 0;
+	int local;
+	void *x = sf_malloc(100);
+
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 8192);
+	void *y = sf_malloc(10000);
+	sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0);
+
+	cr_assert(sf_owns(x), "A heap block is not the allocator's");
+	cr_assert(sf_owns(y), "A large block is not the allocator's");
+	cr_assert(!sf_owns(&local), "A stack address is the allocator's");
+	cr_assert(!sf_owns(NULL), "NULL is the allocator's");
+
+	sf_free(y);
+	cr_assert(!sf_owns(y), "An unmapped large block is still the allocator's");
+	sf_free(x);
+	cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
@@ -0,0 +1,433 @@
+/**
+ * Trace-replay driver in the manner of the malloc lab's mdriver.
+ *
+ * Replays allocation traces against the sf allocator and, as a baseline, the system's malloc,
+ * printing one CSV row per trace and allocator: throughput over repeated timed replays, and
+ * the peak heap next to the peak of the bytes the trace had live, whose ratio is the
+ * utilization.  A first, untimed replay checks every block: aligned, not overlapping any
+ * other live block, and still holding the bytes written into it.
+ *
+ * A trace is text: four header lines (suggested heap size, ignored; number of ids; number of
+ * operations; weight, ignored), then one operation per line:
+ *   a id size          allocate
+ *   m id size align    allocate, aligned (sf_memalign)
+ *   r id size          reallocate
+ *   f id               free
+ * bin/sftrace -r turns a recorded trace into one.
+ */
+#define _GNU_SOURCE // mallinfo2, MAP_ANONYMOUS
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define REPLAY_MIN_NS 200000000ULL // Timed replays of a trace run until they add up to this
+#define REPLAY_MIN_RUNS 3
+#define REPLAY_ALIGN 16            // What every block must be aligned to, the system's guarantee
+
+/* Replayed when no trace is named */
+#define REPLAY_DEFAULT_TRACES \
+    "traces/fixed-churn.rep", "traces/producer-consumer.rep", "traces/realloc-growth.rep", "traces/powerlaw.rep"
+
+typedef struct replay_op {
+    char type;
+    int id;
+    size_t size;
+    size_t align;
+} replay_op;
+
+typedef struct replay_trace {
+    const char *name;
+    int num_ids;
+    int num_ops;
+    replay_op *ops;
+} replay_trace;
+
+typedef struct replay_allocator {
+    const char *name;
+    void (*init)(void);
+    void (*fini)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *pp);
+    void *(*realloc)(void *pp, size_t size);
+    void *(*memalign)(size_t size, size_t align);
+    size_t (*heap_bytes)(void); // How much memory the allocator holds right now
+    size_t (*base_bytes)(void); // What of that is not the trace's, taken before replaying it
+} replay_allocator;
+
+typedef struct replay_block {
+    char *pp;
+    size_t size;
+} replay_block;
+
+static size_t sf_heap_bytes(void)
+{
+    return (char *)sf_mem_end() - (char *)sf_mem_start();
+}
+
+static size_t sf_base_bytes(void)
+{
+    return 0;
+}
+
+static void no_op(void)
+{
+}
+
+static void *system_memalign(size_t size, size_t align)
+{
+    void *pp;
+    return posix_memalign(&pp, align, size) == 0 ? pp : NULL;
+}
+
+/*
+ * The system heap up to its highest chunk in use, plus mappings: the arena's top chunk is
+ * slack glibc grew ahead of need, as the pages past sf's wilderness block are not.
+ */
+static size_t system_heap_bytes(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.arena - info.keepcost + info.hblkhd;
+}
+
+/*
+ * What the system heap holds that is not the trace's: stdout's buffer, and sf's heap while
+ * sfutil keeps it.
+ */
+static size_t system_base_bytes(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static const replay_allocator allocators[] = {
+    {"sf", sf_mem_init, sf_mem_fini, sf_malloc, sf_free, sf_realloc, sf_memalign, sf_heap_bytes, sf_base_bytes},
+    {"system", no_op, no_op, malloc, free, realloc, system_memalign, system_heap_bytes, system_base_bytes},
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The driver keeps its own memory out of the system heap, so none of what the system
+ * allocator holds during a replay is the driver's and no hole the driver freed gets filled.
+ */
+static void *driver_alloc(size_t size)
+{
+    void *pp = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (pp == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+
+    return pp;
+}
+
+static void driver_free(void *pp, size_t size)
+{
+    munmap(pp, size);
+}
+
+static int parse_number(char **cursor, long *value)
+{
+    char *end;
+
+    *value = strtol(*cursor, &end, 10);
+    if (end == *cursor || *value < 0)
+        return 0;
+
+    *cursor = end;
+    return 1;
+}
+
+static int read_trace(const char *path, replay_trace *trace)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    long header[4], id, size, align;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    char *text = driver_alloc(st.st_size + 1), *cursor = text;
+    ssize_t length = read(fd, text, st.st_size);
+    close(fd);
+
+    if (length != st.st_size)
+    {
+        perror(path);
+        driver_free(text, st.st_size + 1);
+        return 0;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (!parse_number(&cursor, &header[i]))
+        {
+            fprintf(stderr, "%s: bad header\n", path);
+            driver_free(text, st.st_size + 1);
+            return 0;
+        }
+    }
+
+    trace->name = path;
+    trace->num_ids = header[1];
+    trace->num_ops = header[2];
+    trace->ops = driver_alloc(trace->num_ops * sizeof(replay_op) + 1);
+
+    for (int i = 0; i < trace->num_ops; i++)
+    {
+        replay_op *op = &trace->ops[i];
+        int ok;
+
+        while (*cursor == ' ' || *cursor == '\n' || *cursor == '\t' || *cursor == '\r')
+            cursor++;
+
+        op->type = *cursor++;
+        ok = op->type != '\0' && strchr("amrf", op->type) != NULL && parse_number(&cursor, &id) && id < trace->num_ids;
+        if (ok && op->type != 'f')
+            ok = parse_number(&cursor, &size);
+        if (ok && op->type == 'm')
+            ok = parse_number(&cursor, &align) && align != 0 && (align & (align - 1)) == 0;
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: bad operation %d\n", path, i + 1);
+            driver_free(text, st.st_size + 1);
+            driver_free(trace->ops, trace->num_ops * sizeof(replay_op) + 1);
+            return 0;
+        }
+
+        op->id = id;
+        op->size = op->type == 'f' ? 0 : size;
+        op->align = op->type == 'm' ? align : 0;
+    }
+
+    driver_free(text, st.st_size + 1);
+    return 1;
+}
+
+static int check_block(const replay_trace *trace, replay_block *blocks, int id, size_t align, int op)
+{
+    replay_block *block = &blocks[id];
+
+    if ((uintptr_t)block->pp % (align > REPLAY_ALIGN ? align : REPLAY_ALIGN) != 0)
+    {
+        fprintf(stderr, "%s: op %d: block %d at %p is misaligned\n", trace->name, op + 1, id, block->pp);
+        return 0;
+    }
+
+    for (int other = 0; other < trace->num_ids; other++)
+    {
+        replay_block *b = &blocks[other];
+
+        if (other != id && b->pp != NULL && b->pp < block->pp + block->size && block->pp < b->pp + b->size)
+        {
+            fprintf(stderr, "%s: op %d: block %d overlaps block %d\n", trace->name, op + 1, id, other);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int check_contents(const replay_trace *trace, const replay_block *block, size_t size, int id, int op)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if ((unsigned char)block->pp[i] != (unsigned char)id)
+        {
+            fprintf(stderr, "%s: op %d: block %d lost its contents\n", trace->name, op + 1, id);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * The checked replay: fills each block with its id, checks it on the way out and samples the
+ * heap after every operation.  Returns 0 if the allocator failed a request or a check.
+ */
+static int replay_checked(const replay_allocator *alloc, const replay_trace *trace, size_t *peak_heap, size_t *peak_live)
+{
+    replay_block *blocks = driver_alloc(trace->num_ids * sizeof(replay_block) + 1);
+    size_t live = 0, base;
+    int ok = 1;
+
+    alloc->init();
+    base = alloc->base_bytes();
+    *peak_heap = *peak_live = 0;
+
+    for (int i = 0; i < trace->num_ops && ok; i++)
+    {
+        replay_op *op = &trace->ops[i];
+        replay_block *block = &blocks[op->id];
+
+        switch (op->type)
+        {
+        case 'a':
+        case 'm':
+            block->pp = op->type == 'a' ? alloc->malloc(op->size) : alloc->memalign(op->size, op->align);
+            block->size = op->size;
+            ok = block->pp != NULL && check_block(trace, blocks, op->id, op->type == 'm' ? op->align : 0, i);
+            if (ok)
+                memset(block->pp, op->id, op->size);
+            live += op->size;
+            break;
+        case 'r':
+        {
+            size_t kept = block->size < op->size ? block->size : op->size;
+
+            block->pp = alloc->realloc(block->pp, op->size);
+            ok = block->pp != NULL && check_block(trace, blocks, op->id, 0, i) && check_contents(trace, block, kept, op->id, i);
+            if (ok)
+                memset(block->pp, op->id, op->size);
+            live += op->size - block->size;
+            block->size = op->size;
+            break;
+        }
+        case 'f':
+            ok = check_contents(trace, block, block->size, op->id, i);
+            alloc->free(block->pp);
+            live -= block->size;
+            block->pp = NULL;
+            block->size = 0;
+            break;
+        }
+
+        if (!ok && block->pp == NULL && op->type != 'f')
+            fprintf(stderr, "%s: op %d: %s could not serve %zu bytes\n", trace->name, i + 1, alloc->name, op->size);
+
+        if (live > *peak_live)
+            *peak_live = live;
+        size_t heap = alloc->heap_bytes();
+        if (heap > base && heap - base > *peak_heap)
+            *peak_heap = heap - base;
+    }
+
+    for (int id = 0; id < trace->num_ids; id++)
+        if (blocks[id].pp != NULL)
+            alloc->free(blocks[id].pp);
+
+    alloc->fini();
+    driver_free(blocks, trace->num_ids * sizeof(replay_block) + 1);
+    return ok;
+}
+
+/*
+ * Replays the trace until REPLAY_MIN_NS of replays have been timed and returns operations per
+ * second.  Only the operations are timed, not setting up or clearing out the heap.
+ */
+static double replay_timed(const replay_allocator *alloc, const replay_trace *trace)
+{
+    void **pps = driver_alloc(trace->num_ids * sizeof(void *) + 1);
+    uint64_t elapsed = 0;
+    long runs = 0;
+
+    while (elapsed < REPLAY_MIN_NS || runs < REPLAY_MIN_RUNS)
+    {
+        alloc->init();
+
+        uint64_t start = now_ns();
+        for (int i = 0; i < trace->num_ops; i++)
+        {
+            replay_op *op = &trace->ops[i];
+
+            switch (op->type)
+            {
+            case 'a':
+                pps[op->id] = alloc->malloc(op->size);
+                break;
+            case 'm':
+                pps[op->id] = alloc->memalign(op->size, op->align);
+                break;
+            case 'r':
+                pps[op->id] = alloc->realloc(pps[op->id], op->size);
+                break;
+            case 'f':
+                alloc->free(pps[op->id]);
+                pps[op->id] = NULL;
+                break;
+            }
+        }
+        elapsed += now_ns() - start;
+        runs++;
+
+        for (int id = 0; id < trace->num_ids; id++)
+        {
+            if (pps[id] != NULL)
+                alloc->free(pps[id]);
+            pps[id] = NULL;
+        }
+        alloc->fini();
+    }
+
+    driver_free(pps, trace->num_ids * sizeof(void *) + 1);
+    return (double)trace->num_ops * runs * 1e9 / elapsed;
+}
+
+static int replay_path(const char *path)
+{
+    int ok = 1;
+    replay_trace trace;
+
+    if (!read_trace(path, &trace))
+        return 0;
+
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++)
+    {
+        const replay_allocator *alloc = &allocators[a];
+        size_t peak_heap, peak_live;
+
+        if (!replay_checked(alloc, &trace, &peak_heap, &peak_live))
+        {
+            printf("%s,%s,%d,failed,,,\n", trace.name, alloc->name, trace.num_ops);
+            ok = 0;
+            continue;
+        }
+
+        printf("%s,%s,%d,%.0f,%zu,%zu,%.3f\n", trace.name, alloc->name, trace.num_ops,
+               replay_timed(alloc, &trace), peak_heap, peak_live,
+               peak_heap == 0 ? 0.0 : (double)peak_live / peak_heap);
+        fflush(stdout);
+    }
+
+    driver_free(trace.ops, trace.num_ops * sizeof(replay_op) + 1);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *defaults[] = {REPLAY_DEFAULT_TRACES};
+    int ok = 1;
+
+    printf("trace,allocator,ops,ops_per_sec,peak_heap,peak_live,util\n");
+
+    if (argc < 2)
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+            ok &= replay_path(defaults[i]);
+
+    for (int i = 1; i < argc; i++)
+        ok &= replay_path(argv[i]);
+
+    return ok ? 0 : 1;
+}
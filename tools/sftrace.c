@@ -0,0 +1,338 @@
+/**
+ * Decoder for the allocation traces written by sf_trace_start.
+ *
+ * Reads every chunk of a trace, orders the events of all threads by timestamp and prints
+ * one line per event.  A free is placed when its call began and anything else when its call
+ * returned, and sf_realloc gives up its old address at the first and takes the new one at the
+ * second, so an address is never live twice.  Addresses become ids: each allocation gets the
+ * next id, sf_realloc hands its block's id on to the new address, and a free of an address
+ * the trace never saw allocated (before the trace started) shows id -1.
+ *
+ * With -r it writes the trace for bin/sfmm_replay instead, leaving out what a replay cannot
+ * repeat: failed requests and frees of blocks from before the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sfmm_ext.h"
+
+typedef struct trace_record {
+    struct sf_trace_event event;
+    uint64_t ticks; // When the record takes effect
+    uint32_t thread;
+    int release;    // The first half of an sf_realloc, which only gives up the old address
+    size_t order;   // Event's position in the file, so events with the same timestamp keep their order
+} trace_record;
+
+/*
+ * Live address to id, open addressing with linear probing.  Removed slots keep address 0
+ * as tombstones marked by id -2, so probe chains stay intact.
+ */
+typedef struct id_slot {
+    uint64_t address;
+    long id;
+} id_slot;
+
+static id_slot *id_table;
+static size_t id_capacity, id_used;
+
+/* One line of replay output, kept until the header's counts are known */
+typedef struct replay_line {
+    char type;
+    long id;
+    unsigned long long size;
+    unsigned long long align;
+} replay_line;
+
+static const char *op_names[SF_OP_COUNT] = {"malloc", "free", "realloc", "memalign", "free_sized",
+                                            "realloc_in_place", "calloc", "malloc_batch", "free_batch"};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c | -r] trace\n"
+            "Prints one line per event in time order: time_ns thread op id size align old_id.\n"
+            "  -c  write CSV, with a header row, instead of space-separated columns\n"
+            "  -r  write a trace for sfmm_replay instead\n",
+            prog);
+    exit(2);
+}
+
+static int compare_records(const void *a, const void *b)
+{
+    const trace_record *x = a, *y = b;
+
+    if (x->ticks != y->ticks)
+        return x->ticks < y->ticks ? -1 : 1;
+    if (x->order != y->order)
+        return x->order < y->order ? -1 : 1;
+    return y->release - x->release;
+}
+
+static int is_free(int op)
+{
+    return op == SF_OP_FREE || op == SF_OP_FREE_SIZED || op == SF_OP_FREE_BATCH;
+}
+
+static size_t id_hash(uint64_t address)
+{
+    return (address / 64 * 0x9e3779b97f4a7c15ULL) & (id_capacity - 1);
+}
+
+static id_slot *id_find(uint64_t address)
+{
+    for (size_t slot = id_hash(address);; slot = (slot + 1) & (id_capacity - 1))
+    {
+        if (id_table[slot].address == address)
+            return &id_table[slot];
+        if (id_table[slot].address == 0 && id_table[slot].id != -2)
+            return NULL;
+    }
+}
+
+static void id_insert(uint64_t address, long id);
+
+static void id_grow(void)
+{
+    id_slot *old = id_table;
+    size_t old_capacity = id_capacity;
+
+    id_capacity = id_capacity == 0 ? 1024 : id_capacity * 2;
+    id_table = calloc(id_capacity, sizeof(id_slot));
+    id_used = 0;
+    if (id_table == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old[i].address != 0)
+            id_insert(old[i].address, old[i].id);
+    free(old);
+}
+
+static void id_insert(uint64_t address, long id)
+{
+    if ((id_used + 1) * 2 > id_capacity) // Tombstones count as used until the next grow
+        id_grow();
+
+    size_t slot = id_hash(address);
+    while (id_table[slot].address != 0)
+        slot = (slot + 1) & (id_capacity - 1);
+
+    id_table[slot].address = address;
+    id_table[slot].id = id;
+    id_used++;
+}
+
+/* Removes address from the table and returns its id, or -1 if it was not there. */
+static long id_take(uint64_t address)
+{
+    id_slot *slot = id_find(address);
+
+    if (slot == NULL)
+        return -1;
+
+    long id = slot->id;
+    slot->address = 0;
+    slot->id = -2;
+    return id;
+}
+
+int main(int argc, char *argv[])
+{
+    int csv = 0, replay = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0)
+            csv = 1;
+        else if (strcmp(argv[i], "-r") == 0)
+            replay = 1;
+        else if (argv[i][0] == '-' || path != NULL)
+            usage(argv[0]);
+        else
+            path = argv[i];
+    }
+    if (path == NULL || (csv && replay))
+        usage(argv[0]);
+
+    FILE *in = fopen(path, "rb");
+    struct sf_trace_header header;
+
+    if (in == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, SF_TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not an sf allocation trace\n", path);
+        return 1;
+    }
+
+    trace_record *records = NULL;
+    size_t count = 0, capacity = 0, events = 0;
+    uint64_t dropped = 0;
+    struct sf_trace_chunk chunk;
+
+    while (fread(&chunk, sizeof(chunk), 1, in) == 1)
+    {
+        dropped += chunk.dropped;
+
+        for (uint32_t i = 0; i < chunk.count; i++)
+        {
+            if (count + 2 > capacity)
+            {
+                capacity = capacity == 0 ? 4096 : capacity * 2;
+                if ((records = realloc(records, capacity * sizeof(trace_record))) == NULL)
+                {
+                    perror("realloc");
+                    return 1;
+                }
+            }
+
+            trace_record *record = &records[count];
+
+            if (fread(&record->event, sizeof(struct sf_trace_event), 1, in) != 1)
+            {
+                fprintf(stderr, "%s: truncated after %zu events\n", path, events);
+                return 1;
+            }
+
+            int op = SF_TRACE_OP(record->event.info);
+
+            if (op < 0 || op >= SF_OP_COUNT)
+            {
+                fprintf(stderr, "%s: event %zu has unknown operation %d\n", path, events, op);
+                return 1;
+            }
+
+            record->ticks = is_free(op) ? record->event.begin_ticks : record->event.ticks;
+            record->thread = chunk.thread;
+            record->release = 0;
+            record->order = events++;
+            count++;
+
+            if (op == SF_OP_REALLOC)
+            {
+                records[count] = *record;
+                records[count - 1].ticks = record->event.begin_ticks;
+                records[count - 1].release = 1;
+                count++;
+            }
+        }
+    }
+    fclose(in);
+
+    qsort(records, count, sizeof(trace_record), compare_records);
+
+    char sep = csv ? ',' : ' ';
+    long next_id = 0;
+    long *carried = calloc(events + 1, sizeof(long)); // Old ids, from each sf_realloc's first half to its second
+    replay_line *lines = replay ? calloc(count + 1, sizeof(replay_line)) : NULL;
+    size_t num_lines = 0;
+
+    if (carried == NULL || (replay && lines == NULL))
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    if (csv)
+        printf("time_ns,thread,op,id,size,align,old_id\n");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct sf_trace_event *event = &records[i].event;
+        int op = SF_TRACE_OP(event->info);
+        long id = -1, old_id = -1;
+
+        if (records[i].release)
+        {
+            carried[records[i].order] = event->old_pp != 0 ? id_take(event->old_pp) : -1;
+            continue;
+        }
+
+        if (is_free(op))
+            id = id_take(event->pp);
+        else if (op == SF_OP_REALLOC_IN_PLACE)
+        {
+            id_slot *slot = id_find(event->old_pp); // The block stays put either way
+
+            old_id = slot != NULL ? slot->id : -1;
+            id = event->pp != 0 ? old_id : -1;
+        }
+        else if (op == SF_OP_REALLOC)
+        {
+            old_id = carried[records[i].order];
+            if (event->pp != 0)
+            {
+                id = old_id != -1 ? old_id : next_id++;
+                id_insert(event->pp, id);
+            }
+            else if (old_id != -1 && SF_TRACE_SIZE(event->info) != 0)
+                id_insert(event->old_pp, old_id); // A failed realloc leaves the block where it was
+        }
+        else if (event->pp != 0)
+        {
+            id = next_id++;
+            id_insert(event->pp, id);
+        }
+
+        if (replay)
+        {
+            replay_line *line = &lines[num_lines];
+            unsigned long long size = SF_TRACE_SIZE(event->info);
+
+            if (id != -1 && op == SF_OP_REALLOC && old_id != -1)
+                *line = (replay_line){'r', id, size, 0};
+            else if (id != -1 && op == SF_OP_REALLOC_IN_PLACE && size != 0)
+                *line = (replay_line){'r', id, size, 0}; // Where the replayed allocator puts it is up to it
+            else if (id != -1 && !is_free(op) && op != SF_OP_REALLOC_IN_PLACE)
+                *line = (replay_line){op == SF_OP_MEMALIGN ? 'm' : 'a', id, size,
+                                      1ULL << SF_TRACE_ALIGN_SHIFT(event->info)};
+            else if (is_free(op) && id != -1)
+                *line = (replay_line){'f', id, 0, 0};
+            else if (op == SF_OP_REALLOC && event->pp == 0 && size == 0 && old_id != -1)
+                *line = (replay_line){'f', old_id, 0, 0}; // sf_realloc to 0 frees
+            else
+                continue;
+
+            num_lines++;
+            continue;
+        }
+
+        printf("%.0f%c%u%c%s%c%ld%c%llu%c%llu%c%ld\n",
+               (records[i].ticks - header.start_ticks) * header.ns_per_tick, sep,
+               records[i].thread, sep, op_names[op], sep, id, sep,
+               (unsigned long long)SF_TRACE_SIZE(event->info), sep,
+               SF_TRACE_ALIGN_SHIFT(event->info) != 0 ? 1ULL << SF_TRACE_ALIGN_SHIFT(event->info) : 0ULL, sep,
+               old_id);
+    }
+
+    if (replay)
+    {
+        printf("0\n%ld\n%zu\n1\n", next_id, num_lines);
+        for (size_t i = 0; i < num_lines; i++)
+        {
+            if (lines[i].type == 'f')
+                printf("f %ld\n", lines[i].id);
+            else if (lines[i].type == 'm')
+                printf("m %ld %llu %llu\n", lines[i].id, lines[i].size, lines[i].align);
+            else
+                printf("%c %ld %llu\n", lines[i].type, lines[i].id, lines[i].size);
+        }
+        free(lines);
+    }
+
+    if (dropped != 0)
+        fprintf(stderr, "%s: %llu events were dropped by full rings or threads with no ring\n", path, (unsigned long long)dropped);
+
+    free(carried);
+    free(records);
+    free(id_table);
+    return 0;
+}